@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""
+Measure page load bytes and time of the web interface.
+
+Against a device (first visit and repeat visit with the browser cache honoured):
+    python3 scripts/bench_page_load.py --url http://192.168.1.50 / /settings/device
+
+Offline, compare the raw data folder with the built one (bytes only):
+    python3 scripts/bench_page_load.py --dir data --dir .pio/build/data / /settings/device
+"""
+import argparse
+import gzip
+import os
+import re
+import time
+import urllib.request
+
+REF_PATTERN = re.compile(r'(?:href|src)="([^"#?]+\.(?:css|js|svg))"')
+
+
+def resolve(page, ref):
+    base = page if page.endswith("/") else page.rsplit("/", 1)[0] + "/"
+    path = os.path.normpath(os.path.join(base, ref)).replace(os.sep, "/")
+    return path if path.startswith("/") else "/" + path
+
+
+def page_file(page):
+    if page.endswith("/"):
+        return page + "index.html"
+    return page if "." in page.rsplit("/", 1)[-1] else page + ".html"
+
+
+class DirSource:
+    """Files from a local folder, .gz variants count with their compressed size."""
+
+    def __init__(self, root):
+        self.root = root
+
+    def get(self, path):
+        full = os.path.join(self.root, path.lstrip("/"))
+        if os.path.exists(full):
+            data = open(full, "rb").read()
+            return data, len(data), ""
+        if os.path.exists(full + ".gz"):
+            packed = open(full + ".gz", "rb").read()
+            return gzip.decompress(packed), len(packed), ""
+        # fingerprinted name in the built folder
+        return None, 0, ""
+
+
+class HttpSource:
+    def __init__(self, url):
+        self.url = url.rstrip("/")
+
+    def get(self, path):
+        req = urllib.request.Request(self.url + path, headers={"Accept-Encoding": "gzip"})
+        with urllib.request.urlopen(req) as res:
+            raw = res.read()
+            data = raw
+            if res.headers.get("Content-Encoding") == "gzip":
+                    data = gzip.decompress(raw)
+            return data, len(raw), res.headers.get("Cache-Control", "")
+
+
+def cached(cache_control):
+    return "immutable" in cache_control or re.search(r"max-age=[1-9]", cache_control) is not None
+
+
+def load(source, page, cache):
+    start = time.time()
+    html, total, _ = source.get(page_file(page))
+    if html is None:
+        raise SystemExit("page not found: " + page)
+
+    requests = 1
+    for ref in sorted(set(REF_PATTERN.findall(html.decode("utf-8", "replace")))):
+        path = resolve(page, ref)
+        if path in cache:
+            continue
+        _, size, cache_control = source.get(path)
+        total += size
+        requests += 1
+        if cached(cache_control):
+            cache.add(path)
+    return total, requests, time.time() - start
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--url", action="append", default=[])
+    parser.add_argument("--dir", action="append", default=[])
+    parser.add_argument("pages", nargs="*", default=["/"])
+    args = parser.parse_args()
+
+    sources = [("dir " + d, DirSource(d)) for d in args.dir] + [("url " + u, HttpSource(u)) for u in args.url]
+    for name, source in sources:
+        print(name)
+        for page in args.pages:
+            cache = set()
+            first = load(source, page, cache)
+            repeat = load(source, page, cache)
+            print("  %-20s first %8d bytes %2d req %6.0f ms | repeat %8d bytes %2d req %6.0f ms" % (
+                page, first[0], first[1], first[2] * 1000, repeat[0], repeat[1], repeat[2] * 1000))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,109 @@
+"""
+Prepare the web assets for the filesystem image.
+
+- css/js files get a content hash in their name (styles.min.css -> styles.min.3f2a9c1e.css)
+  and the html references are rewritten, so the server can mark them immutable
+- text assets are stored gzip compressed only (<file>.gz), the web server sends them
+  with Content-Encoding: gzip
+- files processed as template on the device (info.html, logs.html) and version.txt stay as they are
+- etags.txt lists a content hash for every other file that is not fingerprinted, the
+  server uses it as ETag so revalidation of pages, images and translations costs a 304
+
+Used as PlatformIO extra_script, the filesystem image is built from $PROJECT_BUILD_DIR/data.
+Can also be run standalone: python3 scripts/build_data.py [--src data] [--out build/data]
+"""
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import shutil
+
+# processed by the device (template placeholders / read by firmware)
+KEEP_PLAIN = {"info.html", "logs.html", "version.txt"}
+
+# loaded by fixed name from javascript, must not be renamed
+NO_FINGERPRINT_DIRS = ("assets/js/i18n/",)
+
+COMPRESS_EXT = (".html", ".css", ".js", ".json", ".svg", ".txt")
+ETAG_MANIFEST = "etags.txt"
+FINGERPRINT_EXT = (".css", ".js")
+
+REF_PATTERN = re.compile(r'((?:\.\./)?)(assets/[^"\'`()\s]+\.(?:css|js))')
+
+
+def fingerprint_name(rel, data):
+    digest = hashlib.sha256(data).hexdigest()[:8]
+    root, ext = os.path.splitext(rel)
+    return "%s.%s%s" % (root, digest, ext)
+
+
+def build(src, out):
+    if os.path.isdir(out):
+        shutil.rmtree(out)
+
+    files = {}
+    for root, _, names in os.walk(src):
+        for name in names:
+            path = os.path.join(root, name)
+            rel = os.path.relpath(path, src).replace(os.sep, "/")
+            with open(path, "rb") as f:
+                files[rel] = f.read()
+
+    # fingerprint css / js
+    renamed = {}
+    for rel, data in files.items():
+        if rel.endswith(FINGERPRINT_EXT) and not rel.startswith(NO_FINGERPRINT_DIRS):
+            renamed[rel] = fingerprint_name(rel, data)
+
+    total_in = total_out = 0
+    etags = []
+    for rel, data in files.items():
+        name = os.path.basename(rel)
+
+        if rel.endswith(".html"):
+            text = data.decode("utf-8")
+            text = REF_PATTERN.sub(lambda m: m.group(1) + renamed.get(m.group(2), m.group(2)), text)
+            data = text.encode("utf-8")
+
+        target = renamed.get(rel, rel)
+        if name not in KEEP_PLAIN and rel.endswith(COMPRESS_EXT):
+            packed = gzip.compress(data, 9, mtime=0)
+            if len(packed) < len(data):
+                data = packed
+                target += ".gz"
+
+        path = os.path.join(out, target)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "wb") as f:
+            f.write(data)
+
+        total_in += len(files[rel])
+        total_out += len(data)
+
+        if rel not in renamed and name not in KEEP_PLAIN:
+            etags.append("/%s %s\n" % (rel, hashlib.sha256(data).hexdigest()[:16]))
+
+    with open(os.path.join(out, ETAG_MANIFEST), "w") as f:
+        f.writelines(sorted(etags))
+
+    print("web assets: %d files, %d -> %d bytes" % (len(files), total_in, total_out))
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO / SCons
+except NameError:
+    env = None
+
+if env is not None:
+    src_dir = env.subst("$PROJECT_DATA_DIR")
+    out_dir = os.path.join(env.subst("$PROJECT_BUILD_DIR"), "data")
+    build(src_dir, out_dir)
+    env.Replace(PROJECT_DATA_DIR=out_dir)
+
+elif __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--src", default="data")
+    parser.add_argument("--out", default="build/data")
+    args = parser.parse_args()
+    build(args.src, args.out)
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+Local stand-in for the GitHub "latest release" API to test the firmware update check.
+
+Build the firmware with
+    build_flags = -D FW_UPDATE_URL=\"http://<pc-ip>:8080/releases/latest\"
+and run
+    python3 scripts/fw_update_standin.py --tag v0.4.0
+
+The response carries a large body like the real API, an ETag, and answers
+If-None-Match with 304 so the caching path can be verified from the log.
+"""
+import argparse
+import hashlib
+import json
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def build_release(tag, padding):
+    release = {
+        "url": "http://localhost/releases/1",
+        "tag_name": tag,
+        "name": tag,
+        "draft": False,
+        "prerelease": False,
+        # the real response is tens of KB, mostly release notes and assets
+        "body": "x" * padding,
+        "assets": [{"name": "firmware.bin", "size": 1234567, "uploader": {"login": "standin"}}],
+    }
+    return json.dumps(release, indent=2).encode()
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def do_GET(self):
+        body = self.server.release
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()
+
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("ETag", etag)
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--tag", default="v9.9.9")
+    parser.add_argument("--padding", type=int, default=30000, help="size of the dummy release notes")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(("0.0.0.0", args.port), Handler)
+    server.release = build_release(args.tag, args.padding)
+    print("serving tag %s on port %d" % (args.tag, args.port))
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
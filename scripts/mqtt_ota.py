@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Push a firmware image to one or more controllers through the MQTT broker.
+
+    # single device
+    python3 scripts/mqtt_ota.py --host 192.168.1.2 --device garage firmware.bin
+    # every controller listening on pandagarage/fleet (HA setting "fleet", off by default),
+    # then resume the ones that missed chunks
+    python3 scripts/mqtt_ota.py --host 192.168.1.2 --fleet --device garage --device carport firmware.bin
+
+Apply device settings (same fields as /api/settings/device):
+
+    python3 scripts/mqtt_ota.py --host 192.168.1.2 --device garage --settings '{"tempUnit":1}'
+
+Protocol (topics below pandagarage/<name> or pandagarage/fleet):
+    ota/begin   {"size": <bytes>, "sha256": "<hex>"}, resumes a running session of the same image
+    ota/chunk   4 byte big endian sequence number + data
+    ota/end     verify sha256 and activate the image
+    ota/state   reported by the device: {"state", "next", "received", "size", "error"}
+
+Requires paho-mqtt (pip install paho-mqtt). Works against a local Mosquitto.
+"""
+import argparse
+import hashlib
+import json
+import struct
+import sys
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+BASE = "pandagarage"
+
+
+class Device:
+    def __init__(self, name):
+        self.name = name
+        self.state = None
+        self.event = threading.Event()
+
+
+def wait_for(device, predicate, timeout):
+    end = time.time() + timeout
+    while time.time() < end:
+        if device.state is not None and predicate(device.state):
+            return device.state
+        device.event.wait(0.2)
+        device.event.clear()
+    return device.state
+
+
+def send_chunks(client, prefix, chunks, start, window, device=None):
+    """Send chunks from start, waiting for the device ack every window chunks."""
+    seq = start
+    while seq < len(chunks):
+        for _ in range(window):
+            if seq >= len(chunks):
+                break
+            client.publish(prefix + "/ota/chunk", struct.pack(">I", seq) + chunks[seq], qos=1).wait_for_publish()
+            seq += 1
+
+        if device is not None:
+            state = wait_for(device, lambda s, n=seq: s["next"] >= n or s["state"] == "error", 10)
+            if state is None or state["state"] == "error":
+                return False
+            # gap detected (lost chunk), resume where the device is
+            seq = min(seq, state["next"])
+            print("\r%s: %d/%d" % (device.name, state["next"], len(chunks)), end="", flush=True)
+    print()
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--device", action="append", default=[], help="device name, repeat for several")
+    parser.add_argument("--fleet", action="store_true", help="send the image once to pandagarage/fleet")
+    parser.add_argument("--chunk", type=int, default=4096)
+    parser.add_argument("--window", type=int, default=8, help="chunks sent before waiting for an ack")
+    parser.add_argument("--settings", help="json object with device settings instead of an image")
+    parser.add_argument("image", nargs="?")
+    args = parser.parse_args()
+
+    devices = {name: Device(name) for name in args.device}
+
+    def on_message(client, userdata, msg):
+        name = msg.topic.split("/")[1]
+        if name in devices:
+            devices[name].state = json.loads(msg.payload)
+            devices[name].event.set()
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.loop_start()
+
+    if args.settings:
+        targets = ["%s/fleet" % BASE] if args.fleet else ["%s/%s" % (BASE, d) for d in devices]
+        for prefix in targets:
+            client.publish(prefix + "/settings/set", args.settings, qos=1).wait_for_publish()
+        return 0
+
+    if not args.image or not devices:
+        parser.error("image and at least one --device are required")
+
+    data = open(args.image, "rb").read()
+    chunks = [data[i:i + args.chunk] for i in range(0, len(data), args.chunk)]
+    begin = json.dumps({"size": len(data), "sha256": hashlib.sha256(data).hexdigest()})
+
+    for name in devices:
+        client.subscribe("%s/%s/ota/state" % (BASE, name), qos=1)
+    time.sleep(0.5)
+
+    if args.fleet:
+        prefix = "%s/fleet" % BASE
+        client.publish(prefix + "/ota/begin", begin, qos=1).wait_for_publish()
+        time.sleep(1)
+        send_chunks(client, prefix, chunks, 0, args.window)
+
+    failed = []
+    for device in devices.values():
+        prefix = "%s/%s" % (BASE, device.name)
+
+        # begin resumes a running session, state tells where to continue
+        device.state = None
+        client.publish(prefix + "/ota/begin", begin, qos=1).wait_for_publish()
+        state = wait_for(device, lambda s: s["state"] in ("receiving", "error"), 10)
+        if state is None or state["state"] != "receiving":
+            failed.append(device.name)
+            continue
+
+        if state["next"] < len(chunks) and not send_chunks(client, prefix, chunks, state["next"], args.window, device):
+            failed.append(device.name)
+            continue
+
+        client.publish(prefix + "/ota/end", "", qos=1).wait_for_publish()
+        state = wait_for(device, lambda s: s["state"] in ("done", "error"), 30)
+        print("%s: %s %s" % (device.name, state["state"] if state else "timeout", state["error"] if state else ""))
+        if state is None or state["state"] != "done":
+            failed.append(device.name)
+
+    client.loop_stop()
+    if failed:
+        print("failed: " + ", ".join(failed))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
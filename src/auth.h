@@ -1,9 +1,33 @@
 #pragma once
 
 #include "mbedtls/sha256.h"
+#include "mbedtls/md.h"
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#define AUTH_SESSIONS 8             // concurrent sessions, the one expiring first is replaced
+#define AUTH_TTL 3600               // session lifetime in seconds
+#define AUTH_TAG_HEX 32             // hmac truncated to 16 bytes
+#define AUTH_TOKEN_LEN 56           // "<id>.<expiry>.<tag>"
 
 extern AppConfig appConfig;
 
+/**
+ * Issued session, requests are verified against this table without computing the hmac again.
+ * Removing an entry revokes the session.
+ */
+struct AuthSession {
+    uint32_t id;                    // 0 = free
+    uint32_t expiry;                // uptime in seconds
+    char tag[AUTH_TAG_HEX + 1];
+};
+
+AuthSession authSessions[AUTH_SESSIONS];
+uint8_t authKey[32];                // random per boot and per revocation
+
+uint32_t authIssued = 0;
+uint32_t authRejected = 0;
+
 
 String sha256(const String& input) {
     uint8_t hash[32];
@@ -23,7 +47,170 @@ String sha256(const String& input) {
     return String(output);
 }
 
+
+// compare without an early exit, the time does not depend on the position of the first difference
+bool authEqual(const char* a, const char* b, size_t len) {
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+
 bool verifyPasswordHash(const String& hashToCheck) {
-    String stored = appConfig.adminPwd;
-    return stored.length() > 0 && stored == hashToCheck;
-}
\ No newline at end of file
+    const size_t len = strlen(appConfig.adminPwd);
+    return len > 0 && hashToCheck.length() == len && authEqual(appConfig.adminPwd, hashToCheck.c_str(), len);
+}
+
+
+uint32_t authUptime() {
+    return esp_timer_get_time() / 1000000;
+}
+
+
+// hmac-sha256 of "<id>.<expiry>" as hex, truncated
+void authSign(uint32_t id, uint32_t expiry, char* tag) {
+    char msg[20];
+    const int len = snprintf(msg, sizeof(msg), "%08x.%x", (unsigned)id, (unsigned)expiry);
+
+    uint8_t mac[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), authKey, sizeof(authKey), (const uint8_t*)msg, len, mac);
+
+    for (uint8_t i = 0; i < AUTH_TAG_HEX / 2; i++) {
+        sprintf(tag + i * 2, "%02x", mac[i]);
+    }
+    tag[AUTH_TAG_HEX] = '\0';
+}
+
+
+/**
+ * Split a token into its parts
+ * @return false if the format is invalid
+ */
+bool authParse(const String& token, uint32_t &id, uint32_t &expiry, const char* &tag) {
+    const int first = token.indexOf('.');
+    const int second = token.indexOf('.', first + 1);
+    if (first != 8 || second < 0 || token.length() - second - 1 != AUTH_TAG_HEX) {
+        return false;
+    }
+
+    char* end;
+    id = strtoul(token.c_str(), &end, 16);
+    if (end != token.c_str() + first) {
+        return false;
+    }
+    expiry = strtoul(token.c_str() + first + 1, &end, 16);
+    if (end != token.c_str() + second) {
+        return false;
+    }
+
+    tag = token.c_str() + second + 1;
+    return true;
+}
+
+
+AuthSession* authFind(AuthSession* table, uint32_t id) {
+    for (uint8_t i = 0; i < AUTH_SESSIONS; i++) {
+        if (table[i].id != 0 && table[i].id == id) {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+
+// start a new session
+String authIssue() {
+    AuthSession *slot = &authSessions[0];
+    for (AuthSession &session : authSessions) {
+        if (session.id == 0) {
+            slot = &session;
+            break;
+        }
+        if (session.expiry < slot->expiry) {
+            slot = &session;
+        }
+    }
+
+    do {
+        slot->id = esp_random();
+    } while (slot->id == 0);
+    slot->expiry = authUptime() + AUTH_TTL;
+    authSign(slot->id, slot->expiry, slot->tag);
+    authIssued++;
+
+    char token[AUTH_TOKEN_LEN];
+    snprintf(token, sizeof(token), "%08x.%x.%s", (unsigned)slot->id, (unsigned)slot->expiry, slot->tag);
+    return String(token);
+}
+
+
+/**
+ * Check a session token against a session table, constant time for the tag
+ * @return the session, nullptr if unknown, revoked or expired
+ */
+AuthSession* authMatch(AuthSession* table, const String& token) {
+    uint32_t id, expiry;
+    const char* tag;
+    if (!authParse(token, id, expiry, tag)) {
+        return nullptr;
+    }
+
+    AuthSession *session = authFind(table, id);
+    if (session == nullptr || session->expiry != expiry || authUptime() >= expiry || !authEqual(session->tag, tag, AUTH_TAG_HEX)) {
+        return nullptr;
+    }
+    return session;
+}
+
+
+// check a token against the issued sessions
+AuthSession* authVerify(const String& token) {
+    AuthSession *session = authMatch(authSessions, token);
+    if (session == nullptr) {
+        authRejected++;
+    }
+    return session;
+}
+
+
+/**
+ * Token for a client that already has a valid session, the same token is kept
+ * until half of its lifetime is over so tabs sharing it stay valid
+ */
+String authRefresh(const String& token, AuthSession* session) {
+    if (session->expiry - authUptime() > AUTH_TTL / 2) {
+        return token;
+    }
+    return authIssue();
+}
+
+
+void authRevoke(AuthSession* session) {
+    session->id = 0;
+}
+
+
+// invalidate every issued token, e.g. after a password change
+void authRevokeAll() {
+    memset(authSessions, 0, sizeof(authSessions));
+    esp_fill_random(authKey, sizeof(authKey));
+}
+
+
+uint8_t authSessionCount() {
+    const uint32_t now = authUptime();
+    uint8_t count = 0;
+    for (const AuthSession &session : authSessions) {
+        if (session.id != 0 && session.expiry > now) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+void initAuth() {
+    authRevokeAll();
+}
@@ -13,6 +13,18 @@
 #define BTN_PIN 0
 #define DEBUG false // set this to true if you want serial output. false to reduce load in production
 
+// release check, override with -D FW_UPDATE_URL=\"http://<host>:<port>/...\" to test against a local server
+#ifndef FW_UPDATE_URL
+#define FW_UPDATE_URL "https://api.github.com/repos/derDeno/PandaGarage/releases/latest"
+#endif
+
+// TLS to the broker needs AsyncTCP built with SSL support (-D ASYNC_TCP_SSL_ENABLED=1)
+#if ASYNC_TCP_SSL_ENABLED
+#define MQTT_TLS_SUPPORTED true
+#else
+#define MQTT_TLS_SUPPORTED false
+#endif
+
 // Default Pref values
 #define PREF_TEMP_UNIT 0 // 0 = Celsius, 1 = Fahrenheit
 #define PREF_EXTERNAL_SENSOR false
@@ -35,6 +47,16 @@
 #define PREF_LOG_LVL 0 // 0 = none, 1 = debug, 2 = info, 3 = warning, 4 = error
 
 #define PREF_HA false
+#define PREF_HA_DEVICE_DISCOVERY false // single message device discovery, requires HA 2024.12+
+#define PREF_HA_AGGREGATE false // all sensor values in one json state message
+#define PREF_HA_KEEPALIVE 10 // seconds, the broker publishes the last will after 1.5x without traffic
+#define PREF_HA_TLS false // requires a build with ASYNC_TCP_SSL_ENABLED
+#define PREF_HA_FLEET false // accept settings and firmware from the shared fleet topic
+
+#define PREF_SYSLOG false
+#define PREF_SYSLOG_PORT 514
+#define PREF_SYSLOG_PROTO 0 // 0 = syslog udp, 1 = syslog tcp, 2 = plain udp
+#define PREF_SYSLOG_LOCAL true
 #define PREF_USE_AUTH true
 #define PREF_ADMIN_PASSWORD "admin"
 
@@ -85,6 +107,20 @@ struct AppConfig {
     uint16_t haPort;            // HA mqtt port
     char haUser[33];            // HA mqtt user
     char haPwd[64];             // HA mqtt password
+    bool haDeviceDiscovery;     // use device based discovery instead of one message per entity
+    bool haAggregate;           // publish sensor values as one json message per cycle
+    uint16_t haKeepAlive;       // mqtt keepalive in seconds
+    bool haTls;                 // connect to the broker with TLS
+    char haFingerprint[41];     // sha1 fingerprint of the broker certificate (hex), empty = not pinned
+    bool haFleet;               // accept commands on pandagarage/fleet (settings, firmware)
+
+
+    // Syslog config
+    bool syslogSet;             // is remote log forwarding enabled
+    char syslogHost[65];        // syslog server host or ip
+    uint16_t syslogPort;        // syslog server port
+    uint8_t syslogProto;        // protocol (0 = syslog udp, 1 = syslog tcp, 2 = plain udp)
+    bool syslogLocal;           // keep writing local log files while forwarding
 
 
     // sensor values
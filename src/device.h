@@ -34,7 +34,9 @@ Adafruit_VL6180X vl;
 SensirionI2cScd4x scd4x;
 
 unsigned long lastBuzzerTime = 0;
+bool buzzerReady = false;       // ledc is set up, done once buzzerSet is true
 TaskHandle_t sensorTaskHandle = NULL;
+uint32_t sensorEvents = 0;
 void sensorTask(void *parameter);
 void initSensorTask();
 unsigned long tuneDuration(int tune) {
@@ -50,7 +52,7 @@ unsigned long tuneDuration(int tune) {
 
 
 // declare it here for the compiler
-void mqttHaPublish(const char* topic, const char* payload, bool retain = true);
+void mqttHaPublish(const char* topic, const char* payload, bool retain = true, uint32_t originUs = 0);
 
 
 void playback(int* melody, int* duration, int length) {
@@ -105,6 +107,7 @@ void playTune(int tune) {
 void setupBuzzer() {
     ledcSetup(BUZZER_CHANNEL, BUZZER_FREQ, BUZZER_RES);
     ledcAttachPin(BUZZER_PIN, BUZZER_CHANNEL);
+    buzzerReady = true;
 
     // play startup tune
     playTune(99);
@@ -115,6 +118,11 @@ void buzzerLoop() {
         return;
     }
 
+    // enabled after boot via settings
+    if (!buzzerReady) {
+        setupBuzzer();
+    }
+
     unsigned long now = millis();
     bool play = false;
 
@@ -193,6 +201,37 @@ void setupSensors() {
     }
 }
 
+// publish all sensor values as one json state, external sensor data goes to the attributes topic
+void sensorPublishAggregate() {
+    char temp[16], humidity[16], pressure[16], lux[16];
+    snprintf(temp, sizeof(temp), "%.2f", appConfig.temperature);
+    snprintf(humidity, sizeof(humidity), "%.2f", appConfig.humidity);
+    snprintf(pressure, sizeof(pressure), "%.2f", appConfig.pressure);
+    snprintf(lux, sizeof(lux), "%.2f", appConfig.lux);
+
+    JsonDocument doc;
+    doc["temp"] = serialized((const char*)temp);
+    doc["humidity"] = serialized((const char*)humidity);
+    doc["pressure"] = serialized((const char*)pressure);
+    doc["lux"] = serialized((const char*)lux);
+
+    if (appConfig.externalSensorSet) {
+        JsonDocument ext;
+        if (!deserializeJson(ext, appConfig.extSensorData)) {
+            for (const char* key : {"co2", "eco2", "tvoc"}) {
+                if (!ext[key].isNull()) {
+                    doc[key] = ext[key];
+                }
+            }
+        }
+        mqttHaPublish("/sensor/attributes", appConfig.extSensorData.c_str(), true);
+    }
+
+    char payload[256];
+    serializeJson(doc, payload, sizeof(payload));
+    mqttHaPublish("/sensor/state", payload, true);
+}
+
 void sensorLoop() {
 
     #ifdef HW1
@@ -216,7 +255,8 @@ void sensorLoop() {
     float lux = lightMeter.readLightLevel();
 
 
-    // external sensors
+    // external sensors, the json is only counted as a change if it differs
+    const String extSensorBefore = appConfig.extSensorData;
     if (appConfig.externalSensorSet) {
         if (appConfig.externalSensor == 1) {  // AHT10
             
@@ -266,8 +306,10 @@ void sensorLoop() {
             serializeJson(doc, appConfig.extSensorData);
 
             // mqtt update
-            String payload = String(co2);
-            mqttHaPublish("/co2/state", payload.c_str(), true);
+            if (!appConfig.haAggregate) {
+                String payload = String(co2);
+                mqttHaPublish("/co2/state", payload.c_str(), true);
+            }
 
         } else if (appConfig.externalSensor == 4) { // CCS811
 
@@ -290,11 +332,13 @@ void sensorLoop() {
                     serializeJson(doc, appConfig.extSensorData);
 
                     // mqtt update
-                    String payload = String(eCO2);
-                    mqttHaPublish("/eco2/state", payload.c_str(), true);
+                    if (!appConfig.haAggregate) {
+                        String payload = String(eCO2);
+                        mqttHaPublish("/eco2/state", payload.c_str(), true);
 
-                    String payload2 = String(TVOC);
-                    mqttHaPublish("/tvoc/state", payload2.c_str(), true);
+                        String payload2 = String(TVOC);
+                        mqttHaPublish("/tvoc/state", payload2.c_str(), true);
+                    }
                 }
             }
         } else if (appConfig.externalSensor == 5) { // VL6180X
@@ -325,83 +369,68 @@ void sensorLoop() {
     bool pressureChanged = fabs(pressure - appConfig.pressure) >= appConfig.presThreshold;
     bool luxChanged = fabs(lux - appConfig.lux) >= appConfig.luxThreshold;
 
-    // check if any sensor value changed
+    // changed values of this cycle are formatted once and go out as a single SSE event
+    char tempStr[16], humidityStr[16], pressureStr[16], luxStr[16];
+    JsonDocument doc;
+    JsonObject sensor = doc["sensor"].to<JsonObject>();
+
     if (tempChanged) {
         appConfig.temperature = temp;
+        snprintf(tempStr, sizeof(tempStr), "%.2f", temp);
+        sensor["temperature"] = (const char*)tempStr;
 
-        // push mqtt update
-        String payload = String(temp, 2);
-        mqttHaPublish("/temp/state", payload.c_str(), true);
-
-        // push SSE update
-        JsonDocument sensor;
-        sensor["temperature"] = payload;
-
-        JsonDocument doc;
-        doc["sensor"] = sensor;
-
-        String response;
-        serializeJson(doc, response);
-        events.send(response.c_str(), "door", millis());
+        if (!appConfig.haAggregate) {
+            mqttHaPublish("/temp/state", tempStr, true);
+        }
     }
 
     if (humidityChanged) {
         appConfig.humidity = humid;
+        snprintf(humidityStr, sizeof(humidityStr), "%.2f", humid);
+        sensor["humidity"] = (const char*)humidityStr;
 
-        // push mqtt update
-        String payload = String(humid, 2);
-        mqttHaPublish("/humidity/state", payload.c_str(), true);
-
-        // push SSE update
-        JsonDocument sensor;
-        sensor["humidity"] = payload;
-
-        JsonDocument doc;
-        doc["sensor"] = sensor;
-
-        String response;
-        serializeJson(doc, response);
-        events.send(response.c_str(), "door", millis());
+        if (!appConfig.haAggregate) {
+            mqttHaPublish("/humidity/state", humidityStr, true);
+        }
     }
 
     if (pressureChanged) {
         appConfig.pressure = pressure;
+        snprintf(pressureStr, sizeof(pressureStr), "%.2f", pressure);
+        sensor["pressure"] = (const char*)pressureStr;
 
-        // push mqtt update
-        String payload = String(pressure, 2);
-        mqttHaPublish("/pressure/state", payload.c_str(), true);
-
-        // push SSE update
-        JsonDocument sensor;
-        sensor["pressure"] = payload;
-
-        JsonDocument doc;
-        doc["sensor"] = sensor;
-
-        String response;
-        serializeJson(doc, response);
-        events.send(response.c_str(), "door", millis());
+        if (!appConfig.haAggregate) {
+            mqttHaPublish("/pressure/state", pressureStr, true);
+        }
     }
 
     if (luxChanged) {
         appConfig.lux = lux;
+        snprintf(luxStr, sizeof(luxStr), "%.2f", lux);
+        sensor["lux"] = (const char*)luxStr;
 
-        // push mqtt update
-        String payload = String(lux, 2);
-        mqttHaPublish("/lux/state", payload.c_str(), true);
+        if (!appConfig.haAggregate) {
+            mqttHaPublish("/lux/state", luxStr, true);
+        }
+    }
 
-        // push SSE update
-        JsonDocument sensor;
-        sensor["lux"] = payload;
+    // the event source shares one message between all clients
+    if (sensor.size() > 0) {
+        char payload[160];
+        serializeJson(doc, payload, sizeof(payload));
+        events.send(payload, "door", millis());
+        sensorEvents++;
+    }
 
-        JsonDocument doc;
-        doc["sensor"] = sensor;
+    const bool extChanged = appConfig.extSensorData != extSensorBefore;
+    if (tempChanged || humidityChanged || pressureChanged || luxChanged || extChanged) {
+        statusTouch();
+    }
 
-        String response;
-        serializeJson(doc, response);
-        events.send(response.c_str(), "door", millis());
+    // one message for all values, unchanged payloads are not sent again
+    if (appConfig.haAggregate) {
+        sensorPublishAggregate();
     }
-    
 }
 
 void sensorTask(void *parameter) {
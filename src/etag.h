@@ -0,0 +1,116 @@
+/*
+* ETags and conditional GET (If-None-Match) for static files and json endpoints
+*/
+#include <ESPAsyncWebServer.h>
+#include <LittleFS.h>
+
+#define ETAG_LEN 24                 // "xxxxxxxx-x-xxxxxxxx" incl. quotes
+#define ETAG_PATH_LEN 40            // max path of a static file with etag
+#define ETAG_STATIC_MAX 48          // max number of static files with etag
+#define ETAG_MANIFEST "/etags.txt"  // written by scripts/build_data.py
+
+/**
+ * Static files that are revalidated by the browser (pages, images, translations).
+ * Fingerprinted css/js are immutable and need no etag.
+ */
+struct StaticEtag {
+    char path[ETAG_PATH_LEN];
+    char etag[ETAG_LEN];
+};
+
+StaticEtag staticEtags[ETAG_STATIC_MAX];
+uint8_t staticEtagCount = 0;
+
+uint32_t etagNotModified = 0;
+
+
+// load the content hashes of the build manifest, one "<path> <hash>" per line
+void loadStaticEtags() {
+    File file = LittleFS.open(ETAG_MANIFEST, "r");
+    if (!file) {
+        logger("No etag manifest", "HTTP", LOG_DEBUG);
+        return;
+    }
+
+    char line[ETAG_PATH_LEN + 24];
+    while (file.available() && staticEtagCount < ETAG_STATIC_MAX) {
+        const size_t len = file.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[len] = '\0';
+
+        char* hash = strchr(line, ' ');
+        if (hash == NULL || hash - line >= ETAG_PATH_LEN) {
+            continue;
+        }
+        *hash++ = '\0';
+
+        StaticEtag &e = staticEtags[staticEtagCount++];
+        strcpy(e.path, line);
+        snprintf(e.etag, sizeof(e.etag), "\"%s\"", hash);
+    }
+    file.close();
+}
+
+
+// same url to file mapping as the static handlers and the not found handler
+const char* findStaticEtag(const String &url) {
+    String path = url;
+    if (path.endsWith("/")) {
+        path += "index.html";
+    } else if (path.lastIndexOf('.') < path.lastIndexOf('/') + 1) {
+        path += ".html";
+    }
+
+    for (uint8_t i = 0; i < staticEtagCount; i++) {
+        if (path == staticEtags[i].path) {
+            return staticEtags[i].etag;
+        }
+    }
+    return nullptr;
+}
+
+
+// versioned etag of a json endpoint, kind separates endpoints with independent versions
+void versionEtag(char* out, size_t len, char kind, uint32_t version) {
+    snprintf(out, len, "\"%08x-%c-%x\"", (unsigned)bootId, kind, (unsigned)version);
+}
+
+
+/**
+ * Answer with 304 if the client already has this version
+ * @return true if the request was answered
+ */
+bool sendNotModified(AsyncWebServerRequest *request, const char* etag) {
+    if (!request->hasHeader("If-None-Match") || request->getHeader("If-None-Match")->value() != etag) {
+        return false;
+    }
+
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", etag);
+    request->send(response);
+    etagNotModified++;
+    return true;
+}
+
+
+// conditional GET for static files listed in the manifest
+void initStaticEtags(AsyncWebServer &server) {
+    loadStaticEtags();
+
+    server.addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+        const char* etag = request->method() == HTTP_GET ? findStaticEtag(request->url()) : nullptr;
+        if (etag == nullptr) {
+            next();
+            return;
+        }
+
+        if (sendNotModified(request, etag)) {
+            return;
+        }
+
+        next();
+        AsyncWebServerResponse *response = request->getResponse();
+        if (response != nullptr) {
+            response->addHeader("ETag", etag);
+        }
+    });
+}
@@ -0,0 +1,240 @@
+/*
+* Home Assistant MQTT discovery, entities are declared in a single table
+*/
+#include <ArduinoJson.h>
+
+#define HA_PAYLOAD_LEN 1024     // max size of a single discovery payload
+#define HA_TOPIC_LEN 128        // max size of a discovery topic
+
+#define HA_HASH_SEED 2166136261u // FNV-1a offset basis
+
+#define HA_MODE_ENTITY 0        // one retained config message per entity
+#define HA_MODE_DEVICE 1        // one retained device config with all components (HA 2024.12+)
+
+extern AppConfig appConfig;
+
+enum HA_FLAGS : uint8_t {
+    HA_STATE = 1 << 0,          // state topic ~/<id>/state
+    HA_CMD = 1 << 1,            // command topic ~/<id>/set
+    HA_AVTY = 1 << 2,           // uses the availability topic ~/status
+    HA_NO_ID_TOPIC = 1 << 3,    // config topic without object id
+    HA_AGG = 1 << 4,            // value is part of the aggregated sensor state ~/sensor/state
+    HA_ATTR = 1 << 5            // carries the external sensor data as attributes in aggregated mode
+};
+
+// bit for an external sensor type (see PREF_EXTERNAL_SENSOR_TYPE)
+#define HA_EXT(type) (1 << (type))
+
+/**
+ * Discovery descriptor of a single entity
+ */
+struct HaEntity {
+    const char* component;              // HA component (sensor, button, cover, ...)
+    const char* objectId;               // object id, used for unique id and topics
+    const char* name;                   // entity name
+    const char* devClass;               // device class or nullptr
+    const char* unit;                   // unit of measurement or nullptr
+    const char* icon;                   // icon or nullptr
+    const char* entCat;                 // entity category or nullptr
+    uint8_t flags;                      // HA_FLAGS
+    uint8_t extSensors;                 // external sensor types the entity belongs to, 0 = always
+    void (*extra)(JsonObject obj);      // component specific fields or nullptr
+};
+
+
+void haLightExtra(JsonObject obj) {
+    obj["cmd_t"] = "~/light/switch";
+    obj["payload_on"] = "ON";
+    obj["payload_off"] = "OFF";
+    obj["state_on"] = "ON";
+    obj["state_off"] = "OFF";
+    obj["brightness"] = false;
+}
+
+void haUpdateExtra(JsonObject obj) {
+    obj["title"] = String(appConfig.name) + " Firmware";
+    obj["platform"] = "update";
+    obj["release_url"] = "https://github.com/derDeno/PandaGarage/releases/latest";
+}
+
+void haCoverExtra(JsonObject obj) {
+    obj["position_topic"] = "~/cover/position";
+    obj["set_position_topic"] = "~/cover/position/set";
+    obj["position_open"] = 100;
+    obj["position_closed"] = 0;
+
+    obj["payload_open"] = "open";
+    obj["payload_close"] = "close";
+    obj["payload_stop"] = "stop";
+
+    obj["state_open"] = "open";
+    obj["state_opening"] = "opening";
+    obj["state_close"] = "closed";
+    obj["state_closing"] = "closing";
+    obj["state_stopped"] = "stopped";
+}
+
+
+static constexpr HaEntity haEntities[] = {
+    // component, id, name, device class, unit, icon, category, flags, external sensors, extra
+    {"button", "restart", "Restart", "restart", nullptr, nullptr, "config", HA_CMD, 0, nullptr},
+    {"sensor", "temp", "Temperature", "temperature", "°C", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG | HA_ATTR, 0, nullptr},
+    {"sensor", "humidity", "Humidity", "humidity", "%", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG, 0, nullptr},
+    {"sensor", "pressure", "Pressure", "pressure", "hPa", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG, 0, nullptr},
+    {"sensor", "lux", "Lux", "illuminance", "lx", "mdi:brightness-5", nullptr, HA_STATE | HA_AVTY | HA_AGG, 0, nullptr},
+    {"update", "update", "Firmware Update", "firmware", nullptr, "mdi:cloud-download", "config", HA_STATE | HA_AVTY | HA_NO_ID_TOPIC, 0, haUpdateExtra},
+    {"light", "light", "Light", "light", nullptr, nullptr, nullptr, HA_STATE | HA_AVTY, 0, haLightExtra},
+    {"button", "vent", "Vent Position", nullptr, nullptr, nullptr, nullptr, HA_CMD | HA_AVTY, 0, nullptr},
+    {"button", "half", "Half Position", nullptr, nullptr, nullptr, nullptr, HA_CMD | HA_AVTY, 0, nullptr},
+    {"button", "toggle", "Toggle Door", nullptr, nullptr, nullptr, nullptr, HA_CMD | HA_AVTY, 0, nullptr},
+    {"cover", "cover", "Door", "garage", nullptr, nullptr, nullptr, HA_STATE | HA_CMD | HA_AVTY, 0, haCoverExtra},
+    {"sensor", "co2", "CO2", "carbon_dioxide", "ppm", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG, HA_EXT(2) | HA_EXT(3), nullptr},
+    {"sensor", "eco2", "eCO2", "volatile_organic_compounds", "ppm", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG, HA_EXT(4), nullptr},
+    {"sensor", "tvoc", "TVOC", "volatile_organic_compounds", "ppb", nullptr, nullptr, HA_STATE | HA_AVTY | HA_AGG, HA_EXT(4), nullptr},
+};
+
+
+// FNV-1a hash to detect changed discovery payloads
+uint32_t haHash(const char* data, size_t len, uint32_t hash = HA_HASH_SEED) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+// is the entity present with the current configuration
+bool haEntityEnabled(const HaEntity &e) {
+    if (e.extSensors == 0) {
+        return true;
+    }
+    return appConfig.externalSensorSet && (e.extSensors & HA_EXT(appConfig.externalSensor));
+}
+
+
+// homeassistant/<component>/<name>/<id>/config
+void haConfigTopic(const HaEntity &e, char* out, size_t len) {
+    if (e.flags & HA_NO_ID_TOPIC) {
+        snprintf(out, len, "homeassistant/%s/%s/config", e.component, appConfig.name);
+    } else {
+        snprintf(out, len, "homeassistant/%s/%s/%s/config", e.component, appConfig.name, e.objectId);
+    }
+}
+
+
+// device block, the full one is only needed once as HA merges device info by id
+void haFillDevice(JsonObject dev, bool full) {
+    dev["name"] = appConfig.name;
+    dev["ids"][0] = appConfig.name;
+
+    if (full) {
+        dev["mdl"] = "PandaGarage Controller";
+        dev["mf"] = "DNO";
+        dev["sw"] = VERSION;
+        dev["cu"] = "http://" + WiFi.localIP().toString() + "/settings";
+        dev["sn"] = appConfig.serialNumber;
+        dev["hw"] = appConfig.hwRev;
+    }
+}
+
+
+// entity fields, topics are relative to the base topic "~"
+void haFillEntity(const HaEntity &e, JsonObject obj, const char* base) {
+    char buf[HA_TOPIC_LEN];
+
+    obj["~"] = base;
+    obj["name"] = e.name;
+
+    snprintf(buf, sizeof(buf), "%s_%s", appConfig.name, e.objectId);
+    obj["uniq_id"] = (const char*)buf;
+
+    if ((e.flags & HA_AGG) && appConfig.haAggregate) {
+        obj["stat_t"] = "~/sensor/state";
+        snprintf(buf, sizeof(buf), "{{ value_json.%s }}", e.objectId);
+        obj["val_tpl"] = (const char*)buf;
+
+        if ((e.flags & HA_ATTR) && appConfig.externalSensorSet) {
+            obj["json_attr_t"] = "~/sensor/attributes";
+        }
+
+    } else if (e.flags & HA_STATE) {
+        snprintf(buf, sizeof(buf), "~/%s/state", e.objectId);
+        obj["stat_t"] = (const char*)buf;
+    }
+    if (e.flags & HA_CMD) {
+        snprintf(buf, sizeof(buf), "~/%s/set", e.objectId);
+        obj["cmd_t"] = (const char*)buf;
+    }
+    if (e.flags & HA_AVTY) {
+        obj["avty_t"] = "~/status";
+    }
+
+    if (e.unit != nullptr) {
+        // temperature follows the configured unit
+        if (strcmp(e.unit, "°C") == 0 && appConfig.tempUnit == 1) {
+            obj["unit_of_meas"] = "°F";
+        } else {
+            obj["unit_of_meas"] = e.unit;
+        }
+    }
+    if (e.icon != nullptr) {
+        obj["icon"] = e.icon;
+    }
+    if (e.entCat != nullptr) {
+        obj["ent_cat"] = e.entCat;
+    }
+    if (e.devClass != nullptr) {
+        obj["dev_cla"] = e.devClass;
+    }
+    if (e.extra != nullptr) {
+        e.extra(obj);
+    }
+}
+
+
+/**
+ * Serialize the discovery payload of one entity into buf
+ * @return length of the payload, 0 if it did not fit
+ */
+size_t haBuildEntity(const HaEntity &e, JsonDocument &doc, const char* base, bool fullDevice, char* buf, size_t len) {
+    doc.clear();
+    JsonObject obj = doc.to<JsonObject>();
+    haFillEntity(e, obj, base);
+    haFillDevice(obj["dev"].to<JsonObject>(), fullDevice);
+
+    if (measureJson(doc) >= len) {
+        return 0;
+    }
+    return serializeJson(doc, buf, len);
+}
+
+
+// homeassistant/device/<name>/config
+void haDeviceTopic(char* out, size_t len) {
+    snprintf(out, len, "homeassistant/device/%s/config", appConfig.name);
+}
+
+
+// device based discovery: device, origin and all enabled entities as components
+void haFillDeviceConfig(JsonDocument &doc, const char* base) {
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    haFillDevice(root["dev"].to<JsonObject>(), true);
+
+    JsonObject origin = root["o"].to<JsonObject>();
+    origin["name"] = "PandaGarage";
+    origin["sw"] = VERSION;
+    origin["url"] = "https://github.com/derDeno/PandaGarage";
+
+    JsonObject cmps = root["cmps"].to<JsonObject>();
+    for (const HaEntity &e : haEntities) {
+        if (!haEntityEnabled(e)) {
+            continue;
+        }
+
+        JsonObject cmp = cmps[e.objectId].to<JsonObject>();
+        cmp["p"] = e.component;
+        haFillEntity(e, cmp, base);
+    }
+}
@@ -79,6 +79,7 @@ class HoermannState {
     String debugMessage = "initial";
 
     unsigned long lastModbusRespone = 0;
+    unsigned long changedAt = 0;    // micros() of the first change since last clearChanged
     bool changed = false;
     bool debMessage = false;
     float gotoPosition = 0.0f;
@@ -86,23 +87,29 @@ class HoermannState {
 
     void setTargetPosition(float targetPosition) {
         this->targetPosition = targetPosition;
-        this->changed = true;
+        this->markChanged();
     }
     void setGotoPosition(float setPosition) {
         this->gotoPosition = setPosition;
-        this->changed = true;
+        this->markChanged();
     }
     void setCurrentPosition(float currentPosition) {
         this->currentPosition = currentPosition;
-        this->changed = true;
+        this->markChanged();
     }
     void setLigthOn(bool lightOn) {
         this->lightOn = lightOn;
-        this->changed = true;
+        this->markChanged();
     }
     void recordModbusResponse() {
         this->lastModbusRespone = millis();
     }
+    void markChanged() {
+        if (!this->changed) {
+            this->changedAt = micros();
+        }
+        this->changed = true;
+    }
     void clearChanged() {
         this->changed = false;
     }
@@ -124,7 +131,7 @@ class HoermannState {
         this->state = state;
         this->translatedState = translateState(state);
         this->coverState = translateCoverState(state);
-        this->changed = true;
+        this->markChanged();
     }
     void setValid(bool isValid) {
         this->valid = isValid;
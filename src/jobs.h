@@ -0,0 +1,49 @@
+/*
+* Low priority background jobs (e.g. network checks) that must not block other tasks
+*/
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#define JOB_QUEUE_LEN 4             // max number of pending jobs
+#define JOB_STACK_SIZE 8192         // TLS handshakes need a large stack
+
+typedef void (*JobFn)();
+
+QueueHandle_t jobQueue = NULL;
+TaskHandle_t jobTaskHandle = NULL;
+
+uint32_t jobsRun = 0;
+uint32_t jobsDropped = 0;
+
+
+/**
+ * Queue a job for the background task, returns immediately
+ * @return false if the job runner is not started or the queue is full
+ */
+bool submitJob(JobFn fn) {
+    if (jobQueue == NULL || xQueueSend(jobQueue, &fn, 0) != pdPASS) {
+        jobsDropped++;
+        return false;
+    }
+    return true;
+}
+
+
+void jobTask(void *parameter) {
+    JobFn fn;
+    while (true) {
+        if (xQueueReceive(jobQueue, &fn, portMAX_DELAY) == pdPASS) {
+            fn();
+            jobsRun++;
+        }
+    }
+}
+
+
+void initJobs() {
+    if (jobQueue == NULL) {
+        jobQueue = xQueueCreate(JOB_QUEUE_LEN, sizeof(JobFn));
+        xTaskCreatePinnedToCore(jobTask, "JobTask", JOB_STACK_SIZE, NULL, 1, &jobTaskHandle, 1);
+    }
+}
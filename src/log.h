@@ -17,9 +17,16 @@ TaskHandle_t logTaskHandle = NULL;
 
 struct LogMessage {
     const char *fileName;
+    uint8_t level;              // log level of the entry
+    char tag[12];               // tag of the entry (e.g. MQTT, BOOT)
+    uint8_t bodyOffset;         // start of the plain log text within data
+    time_t timestamp;           // unix time when the entry was created (0 if not synced)
     char data[LOG_MSG_LEN];
 };
 
+// declare it here for the compiler, defined in syslog-helper.h
+void syslogForward(const LogMessage &msg);
+
 enum LOG_LVL {
     LOG_NONE,
     LOG_DEBUG,
@@ -103,6 +110,16 @@ void logTask(void *parameter) {
     LogMessage msg;
     while (true) {
         if (xQueueReceive(logQueue, &msg, portMAX_DELAY) == pdPASS) {
+
+            // forward to remote syslog if enabled
+            if (appConfig.syslogSet) {
+                syslogForward(msg);
+
+                if (!appConfig.syslogLocal) {
+                    continue;
+                }
+            }
+
             checkLogFileSize(msg.fileName);
             File logFile = LittleFS.open(msg.fileName, "a");
             if (logFile) {
@@ -148,6 +165,11 @@ void logger(String logData, String tag = "", LOG_LVL level = LOG_DEBUG) {
     if (logQueue != NULL) {
         LogMessage msg;
         msg.fileName = "/log.csv";
+        msg.level = level;
+        strncpy(msg.tag, tag.c_str(), sizeof(msg.tag) - 1);
+        msg.tag[sizeof(msg.tag) - 1] = '\0';
+        msg.bodyOffset = min(message.length() - escaped.length(), (unsigned int)(LOG_MSG_LEN - 1));
+        msg.timestamp = time(nullptr);
         strncpy(msg.data, message.c_str(), LOG_MSG_LEN - 1);
         msg.data[LOG_MSG_LEN - 1] = '\0';
         xQueueSend(logQueue, &msg, 0);
@@ -174,6 +196,11 @@ void loggerAccess(String logData, String source) {
     if (logQueue != NULL) {
         LogMessage msg;
         msg.fileName = "/log-access.txt";
+        msg.level = LOG_INFO;
+        strncpy(msg.tag, source.c_str(), sizeof(msg.tag) - 1);
+        msg.tag[sizeof(msg.tag) - 1] = '\0';
+        msg.bodyOffset = min(logMessage.length() - logData.length(), (unsigned int)(LOG_MSG_LEN - 1));
+        msg.timestamp = time(nullptr);
         strncpy(msg.data, logMessage.c_str(), LOG_MSG_LEN - 1);
         msg.data[LOG_MSG_LEN - 1] = '\0';
         xQueueSend(logQueue, &msg, 0);
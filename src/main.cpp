@@ -10,11 +10,22 @@
 #include "fs-helper.h"
 #include "config.h"
 #include "log.h"
+#include "status.h"
+#include "syslog-helper.h"
+#include "jobs.h"
 #include "wifi-helper.h"
 #include "hoermann.h"
 #include "device.h"
+#include "ha-discovery.h"
+#include "settings.h"
+#include "ota-helper.h"
 #include "mqtt-helper.h"
+#include "status-cache.h"
 #include "auth.h"
+#include "etag.h"
+#include "template.h"
+#include "rate-limit.h"
+#include "ws-helper.h"
 #include "webserver.h"
 
 
@@ -22,6 +33,7 @@ AppConfig appConfig;
 Preferences pref;
 AsyncWebServer server(80);
 AsyncEventSource events("/api/events");
+AsyncWebSocket ws("/api/ws");
 
 void initConfig() {
     
@@ -53,10 +65,13 @@ void initConfig() {
   strcpy(appConfig.lang, pref.getString("lang", "en").c_str());
   appConfig.sensorUpdateInterval = pref.getInt("sensorInterval", PREF_SENSOR_UPDATE_INTERVAL);
   appConfig.tempUnit = pref.getInt("tempUnit", PREF_TEMP_UNIT);
+  settingsMigrateFloat("thresholdHum");
+  settingsMigrateFloat("thresholdPres");
+  settingsMigrateFloat("thresholdLux");
   appConfig.tempThreshold = pref.getFloat("thresholdTemp", PREF_THRESHOLD_TEMP);
-  appConfig.humThreshold = pref.getInt("thresholdHum", PREF_THRESHOLD_HUM);
-  appConfig.presThreshold = pref.getInt("thresholdPres", PREF_THRESHOLD_PRES);
-  appConfig.luxThreshold = pref.getInt("thresholdLux", PREF_THRESHOLD_LUX);
+  appConfig.humThreshold = pref.getFloat("thresholdHum", PREF_THRESHOLD_HUM);
+  appConfig.presThreshold = pref.getFloat("thresholdPres", PREF_THRESHOLD_PRES);
+  appConfig.luxThreshold = pref.getFloat("thresholdLux", PREF_THRESHOLD_LUX);
   appConfig.externalSensorSet = pref.getBool("extSensorSet", PREF_EXTERNAL_SENSOR);
   appConfig.externalSensor = pref.getInt("extSensor", PREF_EXTERNAL_SENSOR_TYPE);
   appConfig.combineSensors = pref.getBool("combineSensors", PREF_COMBINE_SENSORS);
@@ -75,6 +90,21 @@ void initConfig() {
   appConfig.haPort = pref.getInt("port", 1883);
   strcpy(appConfig.haUser, pref.getString("user", "").c_str());
   strcpy(appConfig.haPwd, pref.getString("pwd", "").c_str());
+  appConfig.haDeviceDiscovery = pref.getBool("devDiscovery", PREF_HA_DEVICE_DISCOVERY);
+  appConfig.haAggregate = pref.getBool("aggregate", PREF_HA_AGGREGATE);
+  appConfig.haKeepAlive = pref.getUShort("keepalive", PREF_HA_KEEPALIVE);
+  appConfig.haTls = pref.getBool("tls", PREF_HA_TLS);
+  appConfig.haFleet = pref.getBool("fleet", PREF_HA_FLEET);
+  strcpy(appConfig.haFingerprint, pref.getString("fingerprint", "").substring(0, 40).c_str());
+  pref.end();
+
+
+  pref.begin("syslog", true);
+  appConfig.syslogSet = pref.getBool("activate", PREF_SYSLOG);
+  strcpy(appConfig.syslogHost, pref.getString("host", "").c_str());
+  appConfig.syslogPort = pref.getInt("port", PREF_SYSLOG_PORT);
+  appConfig.syslogProto = pref.getInt("proto", PREF_SYSLOG_PROTO);
+  appConfig.syslogLocal = pref.getBool("local", PREF_SYSLOG_LOCAL);
   pref.end();
 
 
@@ -110,26 +140,23 @@ void initConfig() {
 void onDoorStateChanged(const HoermannState &s) {
 
   // publish to Home Assistant
-  mqttHaPublish("/cover/position", String((s.currentPosition * 100)).c_str(), true);
-  mqttHaPublish("/cover/state", String(s.coverState).c_str(), true);
-  mqttHaPublish("/light/state", (s.lightOn ? "ON" : "OFF"), false);
+  // pass the time of the register broadcast for latency measurement
+  mqttHaPublishDoorState(s, s.changedAt);
+  statusTouch();
   
 
-  // publish to server sent events in same format as api status for compatibility
-  JsonDocument door;
-  door["position_current"] = (s.currentPosition * 100);
-  door["position_target"] = (s.targetPosition * 100);
-  door["state"] = s.translatedState;
-  door["moving"] = s.currentPosition != s.targetPosition;
-  door["light"] = s.lightOn;
-
-  JsonDocument doc;
-  doc["door"] = door;
-
-  String response;
-  serializeJson(doc, response);
-
-  events.send(response.c_str(), "door", millis());
+  // publish to server sent events, same json as /api/status
+  uint32_t version;
+  char json[STATUS_CACHE_LEN];
+  if (statusSnapshot(json, sizeof(json), version) > 0) {
+    events.send(json, "door", millis());
+  } else {
+    JsonDocument doc;
+    statusBuild(doc);
+    String payload;
+    serializeJson(doc, payload);
+    events.send(payload.c_str(), "door", millis());
+  }
 }
 
 
@@ -145,6 +172,14 @@ void setup() {
 
   // Initialize application config
   initConfig();
+  initStatus();
+
+  // start remote log forwarding
+  initSyslog();
+
+  // start background job runner
+  initJobs();
+  initOta();
 
   // start garage door connection
   if (appConfig.setupDone) {
@@ -171,9 +206,13 @@ void setup() {
   });
 
 
+  // session key from the hardware rng, the radio is running at this point
+  initAuth();
+
   // Start server
   routing(server);
   server.addHandler(&events);
+  initWebSocket(server);
   server.begin();
   logger("HTTP Server: ok", "BOOT", LOG_INFO);
   
@@ -181,7 +220,6 @@ void setup() {
   // start mqtt for Home Assistant
   if (appConfig.haSet) {
       if (mqttHaSetup()) {
-          mqttHaReconnect();
           initMqttTask();
       }
   }
@@ -223,20 +261,11 @@ void loop() {
   // if update is in progress sent mqtt update
   if (updateInProgress && appConfig.haSet && lastReportedPct != currentPct) {
 
-    JsonDocument doc;
-    doc["installed_version"] = VERSION;
-    doc["latest_version"] = appConfig.latestFw;
-    doc["entity_picture"] = "https://raw.githubusercontent.com/derDeno/PandaGarage/refs/heads/gh-pages/img/logo.png";
-    doc["release_url"] = "https://github.com/derDeno/PandaGarage/releases/latest";
-    doc["update_percentage"] = currentPct;
-
-    String state;
-    serializeJson(doc, state);
-    mqttHaPublish("/update/state", state.c_str(), true);
-
+    mqttHaPublishUpdateState(currentPct);
     lastReportedPct = currentPct;
   }
 
+  wsLoop();
   wifiLoop();
   delay(10);
 }
@@ -3,130 +3,470 @@
 */
 #include <AsyncMqttClient.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #define MQTT_TOPIC_LEN 128
 #define MQTT_PAYLOAD_LEN 256
+#define MQTT_SUFFIX_LEN 32      // max length of a topic below the device base (e.g. /cover/state)
+#define MQTT_STORE_SIZE 24      // max number of distinct state topics
+#define MQTT_HOUSEKEEPING_INTERVAL 2000 // ms between reconnect / update checks
+#define MQTT_CONNECT_TIMEOUT 10000      // ms until a connection attempt is given up
+#define MQTT_BACKOFF_MIN 1000           // ms first reconnect delay
+#define MQTT_BACKOFF_MAX 60000          // ms max reconnect delay
+#define MQTT_DISCONNECT_REASONS 8       // number of AsyncMqttClientDisconnectReason values
+#define MQTT_ACK_TIMEOUT 5000           // ms until an unacknowledged QoS 1 publish is sent again
+#define MQTT_HA_STATUS_TOPIC "homeassistant/status" // HA birth / last will topic
+#define MQTT_FLEET_BASE "pandagarage/fleet"         // topics received by every controller
+#define MQTT_RX_LEN (OTA_CHUNK_MAX + 8)             // max incoming payload (ota chunk + header)
+#define MQTT_RESTART_DELAY 2000                     // ms to flush the reply before restarting
 
 extern AppConfig appConfig;
+extern bool updateInProgress;
+extern volatile int currentPct;
 
 AsyncMqttClient mqttClientHa;
-bool configSent = false;
 bool mqttInitState = false;
+volatile bool mqttHaResyncPending = false;
+volatile uint8_t mqttReconfigurePending = 0;     // SETTINGS_EFFECT flags, see settings.h
+uint32_t mqttResyncs = 0;
+unsigned long mqttRestartAt = 0;    // millis() of a pending restart, 0 if none
 
 static const unsigned long GH_UPDATE_INTERVAL = 24UL * 60UL * 60UL * 1000UL;
 static unsigned long lastGhUpdateCheck = 0;
 
-struct MqttMessage {
-    char topic[MQTT_TOPIC_LEN];
-    char payload[MQTT_PAYLOAD_LEN];
-    bool retain;
+/**
+ * Last value store for outgoing state topics, doubles as outbox for QoS 1 topics.
+ * Each topic keeps only its newest value and is published once when dirty.
+ * QoS 1 entries stay inflight until the broker acknowledged them, a superseded
+ * value simply replaces the pending one.
+ */
+struct MqttEntry {
+    char topic[MQTT_SUFFIX_LEN];        // topic below the device base
+    char payload[MQTT_PAYLOAD_LEN];     // newest value
+    bool retain;                        // publish retained
+    bool dirty;                         // newest value not yet published
+    uint8_t qos;                        // 0 or 1
+    uint16_t packetId;                  // packet id of the unacknowledged publish, 0 if none
+    unsigned long sentAt;               // millis() of the unacknowledged publish
+    uint32_t originUs;                  // micros() of the source event, 0 if not measured
 };
 
-QueueHandle_t mqttQueue = NULL;
+// state topics that must not get lost when the link flaps
+static const char* const mqttQos1Topics[] = {
+    "/status",
+    "/cover/state",
+    "/cover/position",
+    "/light/state",
+};
+
+MqttEntry mqttStore[MQTT_STORE_SIZE];
+uint8_t mqttStoreCount = 0;
+SemaphoreHandle_t mqttStoreMutex = NULL;
 TaskHandle_t mqttTaskHandle = NULL;
 
+enum MQTT_CONN_STATE {
+    MQTT_DISCONNECTED,
+    MQTT_CONNECTING,
+    MQTT_CONNECTED
+};
+
+volatile MQTT_CONN_STATE mqttConnState = MQTT_DISCONNECTED;
+volatile bool mqttConnectedPending = false;
+unsigned long mqttConnectStarted = 0;
+unsigned long mqttNextAttempt = 0;
+uint32_t mqttBackoff = MQTT_BACKOFF_MIN;
+
+// connection statistics
+uint32_t mqttConnects = 0;
+uint32_t mqttReconnects = 0;
+uint32_t mqttConnectAttempts = 0;
+uint32_t mqttDisconnectReasons[MQTT_DISCONNECT_REASONS] = {0};
+int8_t mqttLastDisconnectReason = -1;
+
+// device base topic (pandagarage/<name>), built once in mqttHaSetup
+char mqttBase[MQTT_TOPIC_LEN];
+size_t mqttBaseLen = 0;
+
+// last will topic, the client keeps a pointer to it
+char mqttWillTopic[MQTT_TOPIC_LEN];
+
+// QoS 1 delivery statistics
+uint32_t mqttAcked = 0;
+uint32_t mqttRetries = 0;
+
+// cost of a connection (tcp, tls handshake and CONNACK)
+uint32_t mqttConnectLastMs = 0;
+uint32_t mqttConnectMaxMs = 0;
+uint32_t mqttConnectHeapBefore = 0;     // free heap when the attempt started
+uint32_t mqttConnectHeapAfter = 0;      // free heap once connected, difference is held by the connection
+
+// broker round trip time, measured from QoS 1 publish to PUBACK
+uint32_t mqttRttLastMs = 0;
+uint32_t mqttRttAvgMs = 0;
+uint32_t mqttRttMaxMs = 0;
+
+// end-to-end latency from register broadcast to MQTT publish
+uint32_t mqttLatencyLastUs = 0;
+uint32_t mqttLatencyAvgUs = 0;
+uint32_t mqttLatencyMaxUs = 0;
+uint32_t mqttLatencySamples = 0;
+
 void mqttTask(void *parameter);
 void initMqttTask();
 void onMqttConnect(bool sessionPresent);
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason);
+void onMqttPublish(uint16_t packetId);
 void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total);
 
 
+// publish the update entity state, latest version is only known after a release check
+void mqttHaPublishUpdateState(int percentage = -1) {
+    JsonDocument doc;
+    doc["installed_version"] = VERSION;
+    if (appConfig.latestFw[0] != '\0') {
+        doc["latest_version"] = appConfig.latestFw;
+    }
+    doc["entity_picture"] = "https://raw.githubusercontent.com/derDeno/PandaGarage/refs/heads/gh-pages/img/logo.png";
+    doc["release_url"] = "https://github.com/derDeno/PandaGarage/releases/latest";
+    if (percentage < 0) {
+        doc["update_percentage"] = nullptr;
+    } else {
+        doc["update_percentage"] = percentage;
+    }
+
+    char state[MQTT_PAYLOAD_LEN];
+    serializeJson(doc, state, sizeof(state));
+    mqttHaPublish("/update/state", state, true);
+}
+
+
+/**
+ * Check for a new release, runs as background job.
+ * The response is parsed straight from the stream and only tag_name is kept,
+ * the ETag of the last response is sent so an unchanged release costs a 304 without body.
+ */
 void checkForFirmwareUpdate() {
-    WiFiClientSecure client;
-    client.setInsecure();
+    static char etag[72] = "";
+
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
 
-    String url = "https://api.github.com/repos/derDeno/PandaGarage/releases/latest";
+    // plain http is only used for a local test server
+    const bool secure = strncmp(FW_UPDATE_URL, "https://", 8) == 0;
+    WiFiClientSecure secureClient;
+    WiFiClient plainClient;
+    secureClient.setInsecure();
 
-    HTTPClient https;
-    https.begin(client, url);
-    https.addHeader("User-Agent", "PandaGarage");
+    HTTPClient http;
+    http.useHTTP10(true); // no chunked encoding, so the body can be parsed from the stream
+    http.setTimeout(10000);
+    if (!http.begin(secure ? secureClient : plainClient, FW_UPDATE_URL)) {
+        return;
+    }
 
-    int httpCode = https.GET();
-    if (httpCode == HTTP_CODE_OK) {
-        String payload = https.getString();
-        https.end();
+    const char* headers[] = {"ETag"};
+    http.collectHeaders(headers, 1);
+    http.addHeader("User-Agent", "PandaGarage");
+    http.addHeader("Accept", "application/vnd.github+json");
+    if (etag[0] != '\0') {
+        http.addHeader("If-None-Match", etag);
+    }
 
-        JsonDocument res;
-        auto err = deserializeJson(res, payload);
-        if (err) {
-            Serial.printf("JSON parse failed: %s\n", err.c_str());
-            return;
+    const int httpCode = http.GET();
+    if (httpCode == HTTP_CODE_NOT_MODIFIED) {
+        http.end();
+        logger("Latest release unchanged", "UPDATE", LOG_DEBUG);
+        mqttHaPublishUpdateState();
+        return;
+    }
+
+    if (httpCode != HTTP_CODE_OK) {
+        http.end();
+        logger("Release check failed: " + String(httpCode), "UPDATE", LOG_WARNING);
+        return;
+    }
+
+    JsonDocument filter;
+    filter["tag_name"] = true;
+
+    JsonDocument res;
+    DeserializationError err = deserializeJson(res, http.getStream(), DeserializationOption::Filter(filter));
+    const char* latestTag = res["tag_name"] | "";
+
+    if (err || latestTag[0] == '\0') {
+        http.end();
+        logger("Release check parse failed: " + String(err.c_str()), "UPDATE", LOG_WARNING);
+        return;
+    }
+
+    strncpy(appConfig.latestFw, latestTag, sizeof(appConfig.latestFw) - 1);
+    appConfig.latestFw[sizeof(appConfig.latestFw) - 1] = '\0';
+
+    strncpy(etag, http.header("ETag").c_str(), sizeof(etag) - 1);
+    etag[sizeof(etag) - 1] = '\0';
+    http.end();
+
+    logger("Latest release: " + String(appConfig.latestFw), "UPDATE", LOG_DEBUG);
+    mqttHaPublishUpdateState();
+}
+
+
+/**
+ * Put a value into the store, the MQTT task publishes it
+ * @param force     publish even if the value did not change (replies to commands)
+ */
+void mqttStorePut(const char* topic, const char* payload, bool retain, uint32_t originUs, bool force) {
+
+    if(!appConfig.haSet || mqttStoreMutex == NULL) {
+        return;
+    }
+
+    if (strlen(topic) >= MQTT_SUFFIX_LEN) {
+        logger("Topic too long: " + String(topic), "MQTT", LOG_ERROR);
+        return;
+    }
+
+    xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+
+    MqttEntry *entry = NULL;
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        if (strcmp(mqttStore[i].topic, topic) == 0) {
+            entry = &mqttStore[i];
+            break;
+        }
+    }
+
+    if (entry == NULL && mqttStoreCount < MQTT_STORE_SIZE) {
+        entry = &mqttStore[mqttStoreCount++];
+        strcpy(entry->topic, topic);
+        entry->payload[0] = '\0';
+        entry->dirty = true;
+        entry->qos = 0;
+        entry->packetId = 0;
+        entry->originUs = 0;
+
+        for (const char* t : mqttQos1Topics) {
+            if (strcmp(t, topic) == 0) {
+                entry->qos = 1;
+                break;
+            }
         }
+    }
 
-        const char* latestTag = res["tag_name"];
-        strcpy(appConfig.latestFw, latestTag);
+    // only mark dirty if the value actually changed
+    bool changed = false;
+    if (entry != NULL && (force || entry->dirty || entry->retain != retain || strncmp(entry->payload, payload, MQTT_PAYLOAD_LEN - 1) != 0)) {
+        strncpy(entry->payload, payload, MQTT_PAYLOAD_LEN - 1);
+        entry->payload[MQTT_PAYLOAD_LEN - 1] = '\0';
+        entry->retain = retain;
 
-        JsonDocument doc;
-        doc["installed_version"] = VERSION;
-        doc["latest_version"] = latestTag;
-        doc["entity_picture"] = "https://raw.githubusercontent.com/derDeno/PandaGarage/refs/heads/gh-pages/img/logo.png";
-        doc["release_url"] = "https://github.com/derDeno/PandaGarage/releases/latest";
-        doc["update_percentage"] = nullptr;
+        // keep the oldest pending origin when values get coalesced
+        if (!entry->dirty || entry->originUs == 0) {
+            entry->originUs = originUs;
+        }
+        entry->dirty = true;
+        changed = true;
+    }
 
-        String state;
-        serializeJson(doc, state);
-        mqttHaPublish("/update/state", state.c_str(), true);
+    xSemaphoreGive(mqttStoreMutex);
 
-    } else {
-        https.end();
+    if (entry == NULL) {
+        logger("State store full, dropping " + String(topic), "MQTT", LOG_ERROR);
         return;
     }
+
+    // wake the MQTT task to publish right away
+    if (changed && mqttTaskHandle != NULL) {
+        xTaskNotifyGive(mqttTaskHandle);
+    }
+}
+
+void mqttHaPublish(const char* topic, const char* payload, bool retain, uint32_t originUs) {
+    mqttStorePut(topic, payload, retain, originUs, false);
+}
+
+// every command gets an answer, even if it is the same as the previous one
+void mqttHaReply(const char* topic, const char* payload) {
+    mqttStorePut(topic, payload, false, 0, true);
+}
+
+
+void mqttRecordLatency(uint32_t latencyUs) {
+    mqttLatencyLastUs = latencyUs;
+    mqttLatencyMaxUs = max(mqttLatencyMaxUs, latencyUs);
+
+    // moving average over ~8 samples
+    if (mqttLatencySamples == 0) {
+        mqttLatencyAvgUs = latencyUs;
+    } else {
+        mqttLatencyAvgUs = mqttLatencyAvgUs - mqttLatencyAvgUs / 8 + latencyUs / 8;
+    }
+    mqttLatencySamples++;
 }
 
 
-void mqttHaPublish(const char* topic, const char* payload, bool retain) {
+// publish all dirty topics of the store, called from the MQTT task
+void mqttStoreFlush() {
+    if (mqttStoreMutex == NULL || !mqttClientHa.connected()) {
+        return;
+    }
+
+    char topic[MQTT_TOPIC_LEN];
+    char payload[MQTT_PAYLOAD_LEN];
+
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+        MqttEntry &entry = mqttStore[i];
+        if (!entry.dirty) {
+            xSemaphoreGive(mqttStoreMutex);
+            continue;
+        }
+
+        snprintf(topic, sizeof(topic), "%s%s", mqttBase, entry.topic);
+        strcpy(payload, entry.payload);
+        const bool retain = entry.retain;
+        const uint8_t qos = entry.qos;
+        const uint32_t originUs = entry.originUs;
+        entry.dirty = false;
+        entry.packetId = 0;
+        entry.originUs = 0;
+        xSemaphoreGive(mqttStoreMutex);
+
+        // publish outside the lock, retry on next flush if the client buffer is full
+        const uint16_t packetId = mqttClientHa.publish(topic, qos, retain, payload);
+        if (packetId == 0) {
+            xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+            if (!entry.dirty) {
+                entry.originUs = originUs;
+            }
+            entry.dirty = true;
+            xSemaphoreGive(mqttStoreMutex);
+            break;
+        }
+
+        // keep QoS 1 entries inflight until the PUBACK arrives
+        if (qos > 0) {
+            xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+            if (!entry.dirty) {
+                entry.packetId = packetId;
+                entry.sentAt = millis();
+            }
+            xSemaphoreGive(mqttStoreMutex);
+        }
+
+        if (originUs != 0) {
+            mqttRecordLatency(micros() - originUs);
+        }
+    }
+}
 
-    if(!appConfig.haSet) {
+
+// mark all known topics for republishing (e.g. after a reconnect)
+void mqttStoreMarkAllDirty() {
+    if (mqttStoreMutex == NULL) {
         return;
     }
 
-    const String mqttBase = String("pandagarage/") + appConfig.name;
-    String fullTopic = mqttBase + topic;
+    xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        mqttStore[i].dirty = true;
+        mqttStore[i].packetId = 0;
+    }
+    xSemaphoreGive(mqttStoreMutex);
+}
+
+
+// broker acknowledged a QoS 1 publish, called from the async tcp task
+void onMqttPublish(uint16_t packetId) {
+    if (mqttStoreMutex == NULL) {
+        return;
+    }
 
-    // if called from MQTT task directly publish
-    if (mqttTaskHandle != NULL && xTaskGetCurrentTaskHandle() == mqttTaskHandle) {
-        if (mqttClientHa.connected()) {
-            mqttClientHa.publish(fullTopic.c_str(), 0, retain, payload);
+    xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        if (mqttStore[i].packetId == packetId) {
+            mqttStore[i].packetId = 0;
+
+            // moving average over ~8 samples
+            const uint32_t rtt = millis() - mqttStore[i].sentAt;
+            mqttRttLastMs = rtt;
+            mqttRttMaxMs = max(mqttRttMaxMs, rtt);
+            mqttRttAvgMs = mqttAcked == 0 ? rtt : mqttRttAvgMs - mqttRttAvgMs / 8 + rtt / 8;
+            mqttAcked++;
+            break;
         }
+    }
+    xSemaphoreGive(mqttStoreMutex);
+}
+
+
+// send unacknowledged QoS 1 publishes again, the client does not retransmit by itself
+void mqttStoreRetry() {
+    if (mqttStoreMutex == NULL) {
         return;
     }
 
-    if (mqttQueue != NULL) {
-        MqttMessage msg;
-        strncpy(msg.topic, fullTopic.c_str(), MQTT_TOPIC_LEN - 1);
-        msg.topic[MQTT_TOPIC_LEN - 1] = '\0';
-        strncpy(msg.payload, payload, MQTT_PAYLOAD_LEN - 1);
-        msg.payload[MQTT_PAYLOAD_LEN - 1] = '\0';
-        msg.retain = retain;
-        xQueueSend(mqttQueue, &msg, 0);
+    const unsigned long now = millis();
+    xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        MqttEntry &entry = mqttStore[i];
+        if (entry.packetId != 0 && now - entry.sentAt >= MQTT_ACK_TIMEOUT) {
+            entry.packetId = 0;
+            entry.dirty = true;
+            mqttRetries++;
+        }
+    }
+    xSemaphoreGive(mqttStoreMutex);
+}
+
+
+// number of QoS 1 publishes waiting for their acknowledgement
+uint8_t mqttStoreInflight() {
+    uint8_t inflight = 0;
+    for (uint8_t i = 0; i < mqttStoreCount; i++) {
+        if (mqttStore[i].packetId != 0) {
+            inflight++;
+        }
     }
+    return inflight;
 }
 
 
-void mqttHaInitState() {
-    mqttHaPublish("/status", "online", true);
+// door and light state, same format for event driven updates and snapshots
+void mqttHaPublishDoorState(const HoermannState &s, uint32_t originUs = 0) {
+    mqttHaPublish("/cover/position", String((s.currentPosition * 100)).c_str(), true, originUs);
+    mqttHaPublish("/cover/state", String(s.coverState).c_str(), true, originUs);
+    mqttHaPublish("/light/state", (s.lightOn ? "ON" : "OFF"), false, originUs);
+}
 
-    mqttHaPublish("/temp/state", String(appConfig.temperature).c_str(), true);
-    mqttHaPublish("/humidity/state", String(appConfig.humidity).c_str(), true);
-    mqttHaPublish("/pressure/state", String(appConfig.pressure).c_str(), true);
-    mqttHaPublish("/lux/state", String(appConfig.lux).c_str(), true);
-    mqttHaPublish("/light/state", "OFF", true);
-    mqttHaPublish("/cover/state", "closed", true);
-    mqttHaPublish("/cover/position", "0", true);
 
-    JsonDocument doc;
-    doc["installed_version"] = VERSION;
-    doc["update_percentage"] = nullptr;
+/**
+ * Put the current state of every entity into the store, the MQTT task then sends
+ * it in one burst. Nothing is published for values that are not known yet.
+ */
+void mqttHaSnapshot() {
+    mqttHaPublish("/status", "online", true);
 
-    String state;
-    serializeJson(doc, state);
-    mqttHaPublish("/update/state", state.c_str(), true);
+    if (appConfig.setupDone && hoermannEngine->state->valid) {
+        mqttHaPublishDoorState(*hoermannEngine->state);
+    }
 
+    if (appConfig.haAggregate) {
+        sensorPublishAggregate();
+    } else {
+        mqttHaPublish("/temp/state", String(appConfig.temperature, 2).c_str(), true);
+        mqttHaPublish("/humidity/state", String(appConfig.humidity, 2).c_str(), true);
+        mqttHaPublish("/pressure/state", String(appConfig.pressure, 2).c_str(), true);
+        mqttHaPublish("/lux/state", String(appConfig.lux, 2).c_str(), true);
+    }
 
-    if (appConfig.externalSensorSet) {
+    mqttHaPublishUpdateState();
+
+    if (appConfig.externalSensorSet && !appConfig.haAggregate) {
         JsonDocument doc;
         DeserializationError error = deserializeJson(doc, appConfig.extSensorData);
 
@@ -135,415 +475,614 @@ void mqttHaInitState() {
             return;
         }
 
-        if (appConfig.externalSensor == 1) { // AHT10
-            //mqttHaPublish("/ext_sensor/state", appConfig.extSensorData.c_str(), true);
-
-        } else if (appConfig.externalSensor == 2 || appConfig.externalSensor == 3) { // SCD40 or SCD41
-            u_int16_t co2 = doc["co2"];
-            String co2Str = String(co2);
-            mqttHaPublish("/co2/state", co2Str.c_str(), true);
-
-        } else if (appConfig.externalSensor == 4) { // CCS811
-            u_int16_t eco2 = doc["eco2"];
-            String eco2Str = String(eco2);
-            mqttHaPublish("/eco2/state", eco2Str.c_str(), true);
-
-            u_int16_t tvoc = doc["tvoc"];
-            String tvocStr = String(tvoc);
-            mqttHaPublish("/tvoc/state", tvocStr.c_str(), true);
-        }
-    }
-
-    delay(250);
-}
-
-
-void mqttHaConfig() {
-    const String mqttBase = String("pandagarage/") + String(appConfig.name);
-    const String availability_topic = String("pandagarage/") + appConfig.name + String("/status");
-
-    // device config
-    JsonDocument device;
-    device["name"] = appConfig.name;
-    device["ids"][0] = appConfig.name;
-    device["mdl"] = "PandaGarage Controller";
-    device["mf"] = "DNO";
-    device["sw"] = VERSION;
-    device["cu"] = "http://" + WiFi.localIP().toString() + "/settings";
-    device["sn"] = appConfig.serialNumber;
-    device["hw"] = appConfig.hwRev;
-
-    // minimal device config for less data transfer
-    JsonDocument deviceMinimal;
-    deviceMinimal["name"] = appConfig.name;
-    deviceMinimal["ids"][0] = appConfig.name;
-
-
-    // button restart
-    // topic: homeassistant/button/pandagarage/reboot/config
-    JsonDocument restart;
-    restart["name"] = "Restart";
-    restart["uniq_id"] = appConfig.name + String("_restart");
-    restart["cmd_t"] = mqttBase + "/restart/set";
-    restart["ent_cat"] = "config";
-    restart["dev_cla"] = "restart";
-    restart["dev"] = device;
-
-
-    // temp sensor
-    // topic: homeassistant/sensor/pandagarage/temp/config
-    JsonDocument tempSensor;
-    tempSensor["name"] = "Temperature";
-    tempSensor["uniq_id"] = appConfig.name + String("_temp");
-    tempSensor["stat_t"] = mqttBase + "/temp/state";
-    tempSensor["avty_t"] = availability_topic;
-    tempSensor["unit_of_meas"] = "°C";
-    tempSensor["dev_cla"] = "temperature";
-    tempSensor["dev"] = device;
-
-    // humidity sensor
-    // topic: homeassistant/sensor/pandagarage/humidity/config
-    JsonDocument humiditySensor;
-    humiditySensor["name"] = "Humidity";
-    humiditySensor["uniq_id"] = appConfig.name + String("_humidity");
-    humiditySensor["stat_t"] = mqttBase + "/humidity/state";
-    humiditySensor["avty_t"] = availability_topic;
-    humiditySensor["unit_of_meas"] = "%";
-    humiditySensor["dev_cla"] = "humidity";
-    humiditySensor["dev"] = device;
-
-    // pressure sensor
-    // topic: homeassistant/sensor/pandagarage/pressure/config
-    JsonDocument pressureSensor;
-    pressureSensor["name"] = "Pressure";
-    pressureSensor["uniq_id"] = appConfig.name + String("_pressure");
-    pressureSensor["stat_t"] = mqttBase + "/pressure/state";
-    pressureSensor["avty_t"] = availability_topic;
-    pressureSensor["unit_of_meas"] = "hPa";
-    pressureSensor["dev_cla"] = "pressure";
-    pressureSensor["dev"] = device;
-
-    // lux sensor
-    // topic: homeassistant/sensor/pandagarage/lux/config
-    JsonDocument luxSensor;
-    luxSensor["name"] = "Lux";
-    luxSensor["uniq_id"] = appConfig.name + String("_lux");
-    luxSensor["stat_t"] = mqttBase + "/lux/state";
-    luxSensor["avty_t"] = availability_topic;
-    luxSensor["unit_of_meas"] = "lx";
-    luxSensor["icon"] = "mdi:brightness-5";
-    luxSensor["dev_cla"] = "illuminance";
-    luxSensor["dev"] = device;
-
-    // update sensor
-    // topic: homeassistant/update/pandagarage/config
-    JsonDocument updateSensor;
-    updateSensor["name"] = "Firmware Update";
-    updateSensor["title"] = appConfig.name + String(" Firmware");
-    updateSensor["platform"] = "update";
-    updateSensor["release_url"] = "https://github.com/derDeno/PandaGarage/releases/latest";
-    updateSensor["uniq_id"] = appConfig.name + String("_update");
-    updateSensor["stat_t"] = mqttBase + "/update/state";
-    updateSensor["avty_t"] = availability_topic;
-    updateSensor["icon"] = "mdi:cloud-download";
-    updateSensor["ent_cat"] = "config";
-    updateSensor["dev_cla"] = "firmware";
-    updateSensor["dev"] = device;
-    
-
-    // light
-    // topic: homeassistant/light/pandagarage/light/config
-    JsonDocument light;
-    light["name"] = "Light";
-    light["uniq_id"] = appConfig.name + String("_light");
-    light["stat_t"] = mqttBase + "/light/state";
-    light["cmd_t"] = mqttBase + "/light/switch";
-    light["avty_t"] = availability_topic;
-    light["payload_on"] = "ON";
-    light["payload_off"] = "OFF";
-    light["state_on"] = "ON";
-    light["state_off"] = "OFF";
-    light["brightness"] = false;
-    light["dev_cla"] = "light";
-    light["dev"] = device;
-
-
-    // button vent
-    // topic: homeassistant/button/pandagarage/vent/config
-    JsonDocument vent;
-    vent["name"] = "Vent Position";
-    vent["uniq_id"] = appConfig.name + String("_vent");
-    vent["avty_t"] = availability_topic;
-    vent["cmd_t"] = mqttBase + "/vent/set";
-    vent["dev"] = device;
-
-
-    // button half
-    // topic: homeassistant/button/pandagarage/half/config
-    JsonDocument half;
-    half["name"] = "Half Position";
-    half["uniq_id"] = appConfig.name + String("_half");
-    half["avty_t"] = availability_topic;
-    half["cmd_t"] = mqttBase + "/half/set";
-    half["dev"] = device;
-
-
-    // button toggle
-    // topic: homeassistant/button/pandagarage/toggle/config
-    JsonDocument toggle;
-    toggle["name"] = "Toggle Door";
-    toggle["uniq_id"] = appConfig.name + String("_toggle");
-    toggle["avty_t"] = availability_topic;
-    toggle["cmd_t"] = mqttBase + "/toggle/set";
-    toggle["dev"] = device;
-
-
-    // cover
-    // topic: homeassistant/cover/pandagarage/cover/config
-    JsonDocument cover;
-    cover["name"] = "Door";
-    cover["uniq_id"] = appConfig.name + String("_cover");
-    cover["avty_t"] = availability_topic;
-    cover["stat_t"] = mqttBase + "/cover/state";
-    cover["cmd_t"] = mqttBase + "/cover/set";
-
-    cover["position_topic"] = mqttBase + "/cover/position";
-    cover["set_position_topic"] = mqttBase + "/cover/position/set";
-    cover["position_open"] = 100;
-    cover["position_closed"] = 0;
-
-    cover["payload_open"] = "open";
-    cover["payload_close"] = "close";
-    cover["payload_stop"] = "stop";
-
-    cover["state_open"] = "open";
-    cover["state_opening"] = "opening";
-    cover["state_close"] = "closed";
-    cover["state_closing"] = "closing";
-    cover["state_stopped"] = "stopped";
-
-    cover["dev_cla"] = "garage";
-    cover["dev"] = device;
-
-
-    // external sensor setup
-    if (appConfig.externalSensorSet) {
-        const uint8_t externalSensorType = appConfig.externalSensor;
-        if (externalSensorType == 1) {
-            // ToDO: AHT10
-            
-        } else if (externalSensorType == 2 || externalSensorType == 3) {
-            JsonDocument co2Sensor;
-            co2Sensor["name"] = "CO2";
-            co2Sensor["uniq_id"] = appConfig.name + String("_co2");
-            co2Sensor["avty_t"] = availability_topic;            
-            co2Sensor["stat_t"] = mqttBase + "/co2/state";
-            co2Sensor["dev"] = device;
-            co2Sensor["dev_cla"] = "carbon_dioxide";
-            co2Sensor["unit_of_meas"] = "ppm";
-
-            String co2Config;
-            serializeJson(co2Sensor, co2Config);
-            mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/co2/config")).c_str(), 0, true, co2Config.c_str());
-
-        } else if (externalSensorType == 4) {
-            JsonDocument eco2Sensor;
-            eco2Sensor["name"] = "eCO2";
-            eco2Sensor["uniq_id"] = appConfig.name + String("_eco2");
-            eco2Sensor["avty_t"] = availability_topic;            
-            eco2Sensor["stat_t"] = mqttBase + "/eco2/state";
-            eco2Sensor["dev"] = device;
-            eco2Sensor["dev_cla"] = "volatile_organic_compounds";
-            eco2Sensor["unit_of_meas"] = "ppm";
-
-            JsonDocument tvocSensor;
-            tvocSensor["name"] = "TVOC";
-            tvocSensor["uniq_id"] = appConfig.name + String("_tvoc");
-            tvocSensor["avty_t"] = availability_topic;            
-            tvocSensor["stat_t"] = mqttBase + "/tvoc/state";
-            tvocSensor["dev"] = device;
-            tvocSensor["dev_cla"] = "volatile_organic_compounds";
-            tvocSensor["unit_of_meas"] = "ppb";
-
-            String eco2Config, tvocConfig;
-            serializeJson(eco2Sensor, eco2Config);
-            serializeJson(tvocSensor, tvocConfig);
-            mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/eco2/config")).c_str(), 0, true, eco2Config.c_str());
-            mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/tvoc/config")).c_str(), 0, true, tvocConfig.c_str());
+        if ((appConfig.externalSensor == 2 || appConfig.externalSensor == 3) && doc["co2"].is<uint16_t>()) { // SCD40 or SCD41
+            mqttHaPublish("/co2/state", String(doc["co2"].as<uint16_t>()).c_str(), true);
 
-        } else {
-            logger("Unknown external sensor type", "MQTT", LOG_ERROR);
+        } else if (appConfig.externalSensor == 4 && doc["eco2"].is<float>()) { // CCS811
+            mqttHaPublish("/eco2/state", String(doc["eco2"].as<float>()).c_str(), true);
+            mqttHaPublish("/tvoc/state", String(doc["tvoc"].as<float>()).c_str(), true);
         }
     }
+}
 
-    
-    // serialize
-    String restartConfig, tempConfig, humidityConfig, pressureConfig, luxConfig, updateConfig, lightConfig, ventConfig, halfConfig, toggleConfig, coverConfig;
-    serializeJson(restart, restartConfig);
-    serializeJson(tempSensor, tempConfig);
-    serializeJson(humiditySensor, humidityConfig);
-    serializeJson(pressureSensor, pressureConfig);
-    serializeJson(luxSensor, luxConfig);
-    serializeJson(updateSensor, updateConfig);
-    serializeJson(light, lightConfig);
-    serializeJson(vent, ventConfig);
-    serializeJson(half, halfConfig);
-    serializeJson(toggle, toggleConfig);
-    serializeJson(cover, coverConfig);
 
+// identity of the broker the retained configs were published to
+uint32_t mqttBrokerHash() {
+    char id[128];
+    int len = snprintf(id, sizeof(id), "%s:%u:%s", appConfig.haIp, appConfig.haPort, appConfig.haUser);
+    return haHash(id, min(len, (int)sizeof(id) - 1));
+}
 
-    // publish
-    mqttClientHa.publish((String("homeassistant/button/") + appConfig.name + String("/restart/config")).c_str(), 0, true, restartConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/temp/config")).c_str(), 0, true, tempConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/humidity/config")).c_str(), 0, true, humidityConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/pressure/config")).c_str(), 0, true, pressureConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/sensor/") + appConfig.name + String("/lux/config")).c_str(), 0, true, luxConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/update/") + appConfig.name + String("/config")).c_str(), 0, true, updateConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/light/") + appConfig.name + String("/light/config")).c_str(), 0, true, lightConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/button/") + appConfig.name + String("/vent/config")).c_str(), 0, true, ventConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/button/") + appConfig.name + String("/half/config")).c_str(), 0, true, halfConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/button/") + appConfig.name + String("/toggle/config")).c_str(), 0, true, toggleConfig.c_str());
-    mqttClientHa.publish((String("homeassistant/cover/") + appConfig.name + String("/cover/config")).c_str(), 0, true, coverConfig.c_str());
 
-    mqttHaInitState();
-}
+/**
+ * Publish per entity discovery, only entities whose payload hash changed are sent
+ * @param doc       reused document
+ * @param hp        open "haDiscovery" preferences holding the published hashes
+ * @param force     publish everything regardless of stored hashes
+ */
+void mqttHaPublishEntities(JsonDocument &doc, Preferences &hp, bool force) {
+    static char payload[HA_PAYLOAD_LEN];
+    char topic[HA_TOPIC_LEN];
+    char key[16];
+
+    const size_t count = sizeof(haEntities) / sizeof(haEntities[0]);
+    uint32_t hashes[count];
+    bool skipped[count];            // payload could not be built, keep what was published before
+    int fullDevice = -1;
+    bool complete = true;
+
+    // first pass: hash every payload without publishing
+    uint32_t setHash = HA_HASH_SEED;
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = 0;
+        skipped[i] = false;
+        const HaEntity &e = haEntities[i];
+        if (!haEntityEnabled(e)) {
+            continue;
+        }
+
+        // the first enabled entity carries the full device block
+        if (fullDevice < 0) {
+            fullDevice = i;
+        }
 
+        size_t len = haBuildEntity(e, doc, mqttBase, fullDevice == (int)i, payload, sizeof(payload));
+        if (len == 0) {
+            logger("Discovery payload too large: " + String(e.objectId), "MQTT", LOG_ERROR);
+            skipped[i] = true;
+            complete = false;
+            continue;
+        }
 
-void mqttHaListen(const char* topic, const char* payload, unsigned int length) {
-    const String mqttBase = String("pandagarage/") + String(appConfig.name);
+        hashes[i] = haHash(payload, len);
+        setHash = haHash((const char*)&hashes[i], sizeof(hashes[i]), setHash);
+    }
 
-    // restart
-    if (strcmp(topic, (mqttBase + "/restart/set").c_str()) == 0) {
-        logger("Restart triggered", "MQTT", LOG_INFO);
-        delay(10);
-        ESP.restart();
+    if (!force && complete && hp.getUInt("set", 0) == setHash) {
+        logger("Discovery unchanged, skipped", "MQTT", LOG_DEBUG);
         return;
     }
 
-    // light switch
-    if (strcmp(topic, (mqttBase + "/light/switch").c_str()) == 0) {
-        String payloadStr = String(payload).substring(0, length);
-        
-        if (payloadStr == "ON") {
-            hoermannEngine->turnLight(true);
-            loggerAccess("Light turned on", "mqtt");
+    // second pass: publish changed entities, remove the disabled ones
+    // a hash is only stored once the publish was accepted, failed ones are sent again next time
+    uint8_t published = 0;
+    for (size_t i = 0; i < count; i++) {
+        const HaEntity &e = haEntities[i];
+        if (skipped[i]) {
+            continue;
+        }
+
+        snprintf(key, sizeof(key), "e_%s", e.objectId);
+        const uint32_t stored = hp.getUInt(key, 0);
+
+        haConfigTopic(e, topic, sizeof(topic));
 
-        } else if (payloadStr == "OFF") {
-            hoermannEngine->turnLight(false);
-            loggerAccess("Light turned off", "mqtt");
+        if (!haEntityEnabled(e)) {
+            if (stored != 0) {
+                if (mqttClientHa.publish(topic, 0, true, "") == 0) {
+                    complete = false;
+                    continue;
+                }
+                hp.remove(key);
+                published++;
+            }
+            continue;
+        }
+
+        if (force || stored != hashes[i]) {
+            size_t len = haBuildEntity(e, doc, mqttBase, fullDevice == (int)i, payload, sizeof(payload));
+            if (mqttClientHa.publish(topic, 0, true, payload, len) == 0) {
+                complete = false;
+                continue;
+            }
+            hp.putUInt(key, hashes[i]);
+            published++;
         }
-        return;
     }
 
-    // cover command
-    if (strcmp(topic, (mqttBase + "/cover/set").c_str()) == 0) {
-        String payloadStr = String(payload).substring(0, length);
+    if (complete) {
+        hp.putUInt("set", setHash);
+    } else {
+        logger("Discovery incomplete, retried on next publish", "MQTT", LOG_WARNING);
+    }
+    logger("Discovery sent for " + String(published) + " entities", "MQTT", LOG_DEBUG);
+}
 
-        if (payloadStr == "open") {
-            hoermannEngine->openDoor();
-            loggerAccess("Door opened", "mqtt");
 
-        } else if (payloadStr == "close") {
-            hoermannEngine->closeDoor();
-            loggerAccess("Door closed", "mqtt");
+void mqttHaPublishDevice(JsonDocument &doc, Preferences &hp, bool force) {
+    char topic[HA_TOPIC_LEN];
+    haDeviceTopic(topic, sizeof(topic));
+    haFillDeviceConfig(doc, mqttBase);
 
-        } else if (payloadStr == "stop") {
-            hoermannEngine->stopDoor();
-            loggerAccess("Door stopped", "mqtt");
-        }
+    const size_t len = measureJson(doc);
+    char* payload = (char*)malloc(len + 1);
+    if (payload == NULL) {
+        logger("Not enough memory for device discovery", "MQTT", LOG_ERROR);
         return;
     }
 
-    // cover position
-    if (strcmp(topic, (mqttBase + "/cover/position/set").c_str()) == 0) {
-        String payloadStr = String(payload).substring(0, length);
-
-        int position = payloadStr.toInt();
-        if (position >= 0 && position <= 100) {
-            hoermannEngine->setPosition(position);
-            loggerAccess("Door position set to " + String(position), "mqtt");
+    serializeJson(doc, payload, len + 1);
+    const uint32_t hash = haHash(payload, len);
 
+    if (force || hp.getUInt("device", 0) != hash) {
+        if (mqttClientHa.publish(topic, 0, true, payload, len) != 0) {
+            hp.putUInt("device", hash);
+            logger("Device discovery sent", "MQTT", LOG_DEBUG);
         } else {
-            logger("Invalid cover position command: " + payloadStr, "MQTT", LOG_ERROR);
+            logger("Device discovery not sent, retried on next publish", "MQTT", LOG_WARNING);
+        }
+
+    } else {
+        logger("Discovery unchanged, skipped", "MQTT", LOG_DEBUG);
+    }
+    free(payload);
+}
+
+
+// publish the same payload to the config topic of every entity in the table
+void mqttHaPublishEntityTopics(const char* payload) {
+    char topic[HA_TOPIC_LEN];
+    for (const HaEntity &e : haEntities) {
+        haConfigTopic(e, topic, sizeof(topic));
+        mqttClientHa.publish(topic, 0, true, payload);
+    }
+}
+
+
+/**
+ * Publish Home Assistant discovery, skipped when the payloads did not change since the
+ * last publish to the same broker
+ * @param force     republish everything (e.g. HA lost its retained configs)
+ */
+void mqttHaConfig(bool force = false) {
+    JsonDocument doc;
+
+    Preferences hp;
+    hp.begin("haDiscovery");
+
+    // hashes are only valid for the broker they were published to
+    const uint8_t mode = appConfig.haDeviceDiscovery ? HA_MODE_DEVICE : HA_MODE_ENTITY;
+    const uint32_t broker = mqttBrokerHash();
+    if (hp.getUInt("broker", 0) != broker) {
+        hp.clear();
+        hp.putUInt("broker", broker);
+        hp.putUChar("mode", mode);
+    }
+
+    // migrate retained configs when the discovery mode changed
+    const bool migrate = hp.getUChar("mode", HA_MODE_ENTITY) != mode;
+    if (migrate) {
+        hp.clear();
+        hp.putUInt("broker", broker);
+        force = true;
+    }
+
+    if (mode == HA_MODE_DEVICE) {
+        if (migrate) {
+            mqttHaPublishEntityTopics("{\"migrate_discovery\":true}");
+        }
+
+        mqttHaPublishDevice(doc, hp, force);
+
+        if (migrate) {
+            mqttHaPublishEntityTopics("");
+        }
+
+    } else {
+        char topic[HA_TOPIC_LEN];
+        haDeviceTopic(topic, sizeof(topic));
+
+        if (migrate) {
+            mqttClientHa.publish(topic, 0, true, "{\"migrate_discovery\":true}");
+        }
+
+        mqttHaPublishEntities(doc, hp, force);
+
+        if (migrate) {
+            mqttClientHa.publish(topic, 0, true, "");
         }
+    }
+
+    if (migrate) {
+        hp.putUChar("mode", mode);
+        logger("Discovery migrated to " + String(mode == HA_MODE_DEVICE ? "device" : "entity") + " mode", "MQTT", LOG_INFO);
+    }
+    hp.end();
+}
+
+
+void mqttCmdRestart(const char* payload, unsigned int length) {
+    logger("Restart triggered", "MQTT", LOG_INFO);
+    delay(10);
+    ESP.restart();
+}
+
+void mqttCmdLight(const char* payload, unsigned int length) {
+    if (strcmp(payload, "ON") == 0) {
+        hoermannEngine->turnLight(true);
+        loggerAccess("Light turned on", "mqtt");
+
+    } else if (strcmp(payload, "OFF") == 0) {
+        hoermannEngine->turnLight(false);
+        loggerAccess("Light turned off", "mqtt");
+    }
+}
+
+void mqttCmdCover(const char* payload, unsigned int length) {
+    if (strcmp(payload, "open") == 0) {
+        hoermannEngine->openDoor();
+        loggerAccess("Door opened", "mqtt");
+
+    } else if (strcmp(payload, "close") == 0) {
+        hoermannEngine->closeDoor();
+        loggerAccess("Door closed", "mqtt");
+
+    } else if (strcmp(payload, "stop") == 0) {
+        hoermannEngine->stopDoor();
+        loggerAccess("Door stopped", "mqtt");
+    }
+}
+
+void mqttCmdPosition(const char* payload, unsigned int length) {
+    char* end;
+    long position = strtol(payload, &end, 10);
+
+    if (end != payload && position >= 0 && position <= 100) {
+        hoermannEngine->setPosition(position);
+        loggerAccess("Door position set to " + String(position), "mqtt");
+
+    } else {
+        logger("Invalid cover position command: " + String(payload), "MQTT", LOG_ERROR);
+    }
+}
+
+void mqttCmdVent(const char* payload, unsigned int length) {
+    loggerAccess("Door set to vent position", "mqtt");
+    hoermannEngine->ventilationPositionDoor();
+}
+
+void mqttCmdHalf(const char* payload, unsigned int length) {
+    loggerAccess("Door set to half position", "mqtt");
+    hoermannEngine->halfPositionDoor();
+}
+
+void mqttCmdToggle(const char* payload, unsigned int length) {
+    loggerAccess("Door toggled", "mqtt");
+    hoermannEngine->toggleDoor();
+}
+
+void mqttScheduleRestart() {
+    mqttRestartAt = millis() + MQTT_RESTART_DELAY;
+    if (mqttRestartAt == 0) {
+        mqttRestartAt = 1;
+    }
+}
+
+// same fields as /api/settings/device, e.g. {"tempUnit":1,"buzzerSet":false}
+void mqttCmdSettings(const char* payload, unsigned int length) {
+    uint8_t effects = SETTINGS_LIVE;
+    const SETTINGS_RESULT result = settingsApplyDeviceJson(payload, length, effects);
+
+    if (result == SETTINGS_INVALID) {
+        mqttHaReply("/settings/state", "{\"status\":\"invalid\"}");
+        return;
+    }
+    if (result == SETTINGS_UNSUPPORTED) {
+        mqttHaReply("/settings/state", "{\"status\":\"unsupported\"}");
+        return;
+    }
+    if (result == SETTINGS_FAILED) {
+        mqttHaReply("/settings/state", "{\"status\":\"failed\"}");
         return;
     }
 
-    // vent command
-    if (strcmp(topic, (mqttBase + "/vent/set").c_str()) == 0) {
-        loggerAccess("Door set to vent position", "mqtt");
-        hoermannEngine->ventilationPositionDoor();
+    // a partial save is committed as well, the written fields are already in use
+    const bool partial = result == SETTINGS_PARTIAL;
+    loggerAccess(partial ? "Settings partially changed" : "Settings changed", "mqtt");
+    if (settingsCommit(effects)) {
+        mqttHaReply("/settings/state", partial ? "{\"status\":\"partial\",\"restart\":true}" : "{\"status\":\"saved\",\"restart\":true}");
+        mqttScheduleRestart();
+    } else {
+        mqttHaReply("/settings/state", partial ? "{\"status\":\"partial\",\"restart\":false}" : "{\"status\":\"saved\",\"restart\":false}");
+    }
+}
+
+void mqttOtaPublishState() {
+    char state[MQTT_PAYLOAD_LEN];
+    otaLock();
+    snprintf(state, sizeof(state), "{\"state\":\"%s\",\"next\":%u,\"received\":%u,\"size\":%u,\"error\":\"%s\"}",
+        otaStateName(otaSession.state), (unsigned)otaSession.next, (unsigned)otaSession.received, (unsigned)otaSession.size, otaSession.error);
+
+    // progress of the HA update entity
+    updateInProgress = otaSession.state == OTA_RECEIVING;
+    currentPct = otaProgress();
+    otaUnlock();
+
+    mqttHaReply("/ota/state", state);
+}
+
+// {"size":<bytes>,"sha256":"<hex>"}, resumes a running session with the same image
+void mqttCmdOtaBegin(const char* payload, unsigned int length) {
+    JsonDocument doc;
+    if (deserializeJson(doc, payload, length)) {
+        otaFail("invalid begin");
+    } else {
+        otaBegin(doc["size"] | 0, doc["sha256"] | "");
+    }
+    mqttOtaPublishState();
+}
+
+// 4 byte big endian sequence number followed by the data
+void mqttCmdOtaChunk(const char* payload, unsigned int length) {
+    if (length <= 4) {
         return;
     }
 
-    // half command
-    if (strcmp(topic, (mqttBase + "/half/set").c_str()) == 0) {
-        loggerAccess("Door set to half position", "mqtt");
-        hoermannEngine->halfPositionDoor();
+    const uint8_t* data = (const uint8_t*)payload;
+    const uint32_t seq = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+    otaWrite(seq, data + 4, length - 4);
+
+    // replies of a burst of chunks are coalesced in the store, the newest state is sent
+    mqttOtaPublishState();
+}
+
+void mqttCmdOtaEnd(const char* payload, unsigned int length) {
+    if (otaEnd()) {
+        mqttScheduleRestart();
+    }
+    mqttOtaPublishState();
+}
+
+
+/**
+ * Command dispatch table, topics are relative to the device base topic.
+ * Suffix lengths are computed at compile time so a lookup is a length check plus memcmp.
+ */
+struct MqttCommand {
+    const char* suffix;
+    uint8_t length;
+    bool fleet;         // also accepted below MQTT_FLEET_BASE
+    void (*handler)(const char* payload, unsigned int length);
+};
+
+#define MQTT_COMMAND(suffix, handler) {suffix, sizeof(suffix) - 1, false, handler}
+#define MQTT_FLEET_COMMAND(suffix, handler) {suffix, sizeof(suffix) - 1, true, handler}
+
+static const MqttCommand mqttCommands[] = {
+    MQTT_COMMAND("/restart/set", mqttCmdRestart),
+    MQTT_COMMAND("/light/switch", mqttCmdLight),
+    MQTT_COMMAND("/cover/set", mqttCmdCover),
+    MQTT_COMMAND("/cover/position/set", mqttCmdPosition),
+    MQTT_COMMAND("/vent/set", mqttCmdVent),
+    MQTT_COMMAND("/half/set", mqttCmdHalf),
+    MQTT_COMMAND("/toggle/set", mqttCmdToggle),
+    MQTT_FLEET_COMMAND("/settings/set", mqttCmdSettings),
+    MQTT_FLEET_COMMAND("/ota/begin", mqttCmdOtaBegin),
+    MQTT_FLEET_COMMAND("/ota/chunk", mqttCmdOtaChunk),
+    MQTT_FLEET_COMMAND("/ota/end", mqttCmdOtaEnd),
+};
+
+
+// build the device base topic once, it only changes with the device name (restart)
+void mqttBuildTopics() {
+    mqttBaseLen = snprintf(mqttBase, sizeof(mqttBase), "pandagarage/%s", appConfig.name);
+    mqttBaseLen = min(mqttBaseLen, sizeof(mqttBase) - 1);
+    snprintf(mqttWillTopic, sizeof(mqttWillTopic), "%s/status", mqttBase);
+}
+
+
+void mqttHaListen(const char* topic, const char* payload, unsigned int length) {
+
+    // Home Assistant (re)started and lost its state, resync in the MQTT task
+    if (strcmp(topic, MQTT_HA_STATUS_TOPIC) == 0) {
+        if (strcmp(payload, "online") == 0) {
+            mqttHaResyncPending = true;
+            xTaskNotifyGive(mqttTaskHandle);
+        }
         return;
     }
 
-    // toggle command
-    if (strcmp(topic, (mqttBase + "/toggle/set").c_str()) == 0) {
-        loggerAccess("Door toggled", "mqtt");
-        hoermannEngine->toggleDoor();
+    // commands live below the device base topic, a subset also below the fleet topic
+    const char* suffix;
+    bool fleet = false;
+    if (strncmp(topic, mqttBase, mqttBaseLen) == 0) {
+        suffix = topic + mqttBaseLen;
+
+    } else if (appConfig.haFleet && strncmp(topic, MQTT_FLEET_BASE, sizeof(MQTT_FLEET_BASE) - 1) == 0) {
+        suffix = topic + sizeof(MQTT_FLEET_BASE) - 1;
+        fleet = true;
+
+    } else {
         return;
     }
+
+    const size_t suffixLen = strlen(suffix);
+
+    for (const MqttCommand &cmd : mqttCommands) {
+        if (cmd.length == suffixLen && memcmp(cmd.suffix, suffix, suffixLen) == 0 && (cmd.fleet || !fleet)) {
+            cmd.handler(payload, length);
+            return;
+        }
+    }
+}
+
+/**
+ * Send discovery and a snapshot of the current state, runs in the MQTT task
+ * @param force     republish discovery even if unchanged (HA lost its retained configs)
+ */
+void mqttHaResync(bool force) {
+    mqttHaConfig(force);
+    mqttHaSnapshot();
+
+    // resend the current value of every known topic
+    mqttStoreMarkAllDirty();
+    mqttResyncs++;
+}
+
+// runs in the MQTT task after the broker accepted the connection
+void mqttHaOnConnected() {
+    mqttHaResync(false);
+
+    // subscribe to command topics only, so our own state publishes are not echoed back
+    char topic[MQTT_TOPIC_LEN];
+    snprintf(topic, sizeof(topic), "%s/+/set", mqttBase);
+    mqttClientHa.subscribe(topic, 1);
+    snprintf(topic, sizeof(topic), "%s/cover/position/set", mqttBase);
+    mqttClientHa.subscribe(topic, 1);
+    snprintf(topic, sizeof(topic), "%s/light/switch", mqttBase);
+    mqttClientHa.subscribe(topic, 1);
+    mqttClientHa.subscribe(MQTT_HA_STATUS_TOPIC, 1);
+
+    // no wildcard, it would also match our own /ota/state replies
+    static const char* const otaTopics[] = {"/ota/begin", "/ota/chunk", "/ota/end"};
+    for (const char* suffix : otaTopics) {
+        snprintf(topic, sizeof(topic), "%s%s", mqttBase, suffix);
+        mqttClientHa.subscribe(topic, 1);
+    }
+
+    // anyone who can publish there could flash firmware, so it has to be enabled explicitly
+    if (appConfig.haFleet) {
+        mqttClientHa.subscribe(MQTT_FLEET_BASE "/settings/set", 1);
+        for (const char* suffix : otaTopics) {
+            snprintf(topic, sizeof(topic), "%s%s", MQTT_FLEET_BASE, suffix);
+            mqttClientHa.subscribe(topic, 1);
+        }
+    }
+}
+
+// schedule the next connection attempt with exponential backoff and jitter
+void mqttScheduleReconnect() {
+    // +-25% jitter so a fleet does not reconnect in lockstep after a broker restart
+    const uint32_t jitter = esp_random() % (mqttBackoff / 2 + 1);
+    mqttNextAttempt = millis() + mqttBackoff - mqttBackoff / 4 + jitter;
+    mqttBackoff = min(mqttBackoff * 2, (uint32_t)MQTT_BACKOFF_MAX);
+    mqttConnState = MQTT_DISCONNECTED;
 }
 
 void onMqttConnect(bool sessionPresent) {
     logger("Connected to Home Assistant", "MQTT", LOG_DEBUG);
 
-    if(!configSent) {
-        mqttHaConfig();
-        configSent = true;
-        logger("Config sent", "MQTT", LOG_DEBUG);
+    if (mqttConnects > 0) {
+        mqttReconnects++;
+    }
+    mqttConnects++;
+    mqttBackoff = MQTT_BACKOFF_MIN;
+    mqttConnState = MQTT_CONNECTED;
+
+    mqttConnectLastMs = millis() - mqttConnectStarted;
+    mqttConnectMaxMs = max(mqttConnectMaxMs, mqttConnectLastMs);
+    mqttConnectHeapAfter = ESP.getFreeHeap();
+    logger("Connect took " + String(mqttConnectLastMs) + " ms, heap " + String(mqttConnectHeapBefore) + " -> " + String(mqttConnectHeapAfter), "MQTT", LOG_DEBUG);
+
+    // heavy work (discovery) is done in the MQTT task, not in the async tcp task
+    mqttConnectedPending = true;
+    if (mqttTaskHandle != NULL) {
+        xTaskNotifyGive(mqttTaskHandle);
     }
-
-    const String topic = String("pandagarage/") + appConfig.name + String("/#");
-    mqttClientHa.subscribe(topic.c_str(), 0);
 }
 
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason) {
-    logger("Disconnected from Home Assistant", "MQTT", LOG_WARNING);
+    const uint8_t r = (uint8_t)reason;
+    if (r < MQTT_DISCONNECT_REASONS) {
+        mqttDisconnectReasons[r]++;
+    }
+    mqttLastDisconnectReason = r;
+
+    logger("Disconnected from Home Assistant, reason " + String(r), "MQTT", LOG_WARNING);
     mqttInitState = false;
+
+    // unacknowledged publishes are sent again after the reconnect
+    if (mqttStoreMutex != NULL) {
+        xSemaphoreTake(mqttStoreMutex, portMAX_DELAY);
+        for (uint8_t i = 0; i < mqttStoreCount; i++) {
+            if (mqttStore[i].packetId != 0) {
+                mqttStore[i].packetId = 0;
+                mqttStore[i].dirty = true;
+            }
+        }
+        xSemaphoreGive(mqttStoreMutex);
+    }
+
+    // a timed out attempt was already rescheduled
+    if (mqttConnState != MQTT_DISCONNECTED) {
+        mqttScheduleReconnect();
+    }
 }
 
+// large payloads (ota chunks) arrive in several fragments and are reassembled here
 void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
-    static char msg[MQTT_PAYLOAD_LEN];
-    size_t copyLen = len < MQTT_PAYLOAD_LEN - 1 ? len : MQTT_PAYLOAD_LEN - 1;
-    memcpy(msg, payload, copyLen);
-    msg[copyLen] = '\0';
-    mqttHaListen(topic, msg, copyLen);
-}
+    static char msg[MQTT_RX_LEN + 1];
 
+    if (total > MQTT_RX_LEN) {
+        if (index == 0) {
+            logger("Message too large: " + String(total) + " bytes", "MQTT", LOG_ERROR);
+        }
+        return;
+    }
 
-int mqttHaReconnect() {
-    
-    // check if wifi is connected
-    if (WiFi.status() != WL_CONNECTED) {
-        return 0;
+    if (index + len > total) {
+        return;
     }
 
-    // if mqtt connected, disconnect first
-    if(mqttClientHa.connected()) {
-        mqttClientHa.disconnect();
+    memcpy(msg + index, payload, len);
+    if (index + len < total) {
+        return;
     }
 
-    mqttClientHa.connect();
+    msg[total] = '\0';
+    mqttHaListen(topic, msg, total);
+}
 
-    int waitCount = 0;
-    while (!mqttClientHa.connected() && waitCount < 10) {
-        delay(500);
-        waitCount++;
-    }
 
-    if (mqttClientHa.connected()) {
-        return 1;
+// non-blocking connection state machine, called from the MQTT task
+void mqttHaConnectStep() {
+    const unsigned long now = millis();
+
+    switch (mqttConnState) {
+        case MQTT_CONNECTED:
+            return;
+
+        case MQTT_CONNECTING:
+            if (now - mqttConnectStarted < MQTT_CONNECT_TIMEOUT) {
+                return;
+            }
+
+            logger("Connection attempt timed out", "MQTT", LOG_WARNING);
+            mqttScheduleReconnect();
+            mqttClientHa.disconnect(true);
+            return;
+
+        case MQTT_DISCONNECTED:
+            if ((long)(now - mqttNextAttempt) < 0 || WiFi.status() != WL_CONNECTED) {
+                return;
+            }
+
+            mqttConnState = MQTT_CONNECTING;
+            mqttConnectStarted = now;
+            mqttConnectAttempts++;
+            mqttConnectHeapBefore = ESP.getFreeHeap();
+            mqttClientHa.connect();
+            return;
     }
+}
+
+// connection parameters, used on the next connect
+void mqttHaApplyConfig() {
+    mqttClientHa.setClientId(appConfig.name);
+    mqttClientHa.setServer(appConfig.haIp, appConfig.haPort);
+    mqttClientHa.setCredentials(appConfig.haUser, appConfig.haPwd);
+
+    // broker marks the device offline when the keepalive expires (crash, power loss)
+    mqttClientHa.setKeepAlive(appConfig.haKeepAlive);
+    mqttClientHa.setWill(mqttWillTopic, 1, true, "offline");
+}
 
-    logger("Failed to connect to HA MQTT", "MQTT", LOG_ERROR);
-    return 0;
+// settings changed at runtime, applied by the MQTT task
+void mqttHaReconfigure(uint8_t effects) {
+    mqttReconfigurePending |= effects;
+    if (mqttTaskHandle != NULL) {
+        xTaskNotifyGive(mqttTaskHandle);
+    }
 }
 
 bool mqttHaSetup() {
@@ -553,60 +1092,124 @@ bool mqttHaSetup() {
         return false;
     }
 
-    mqttClientHa.setClientId(appConfig.name);
-    mqttClientHa.setServer(appConfig.haIp, appConfig.haPort);
-    mqttClientHa.setCredentials(appConfig.haUser, appConfig.haPwd);
+    if (appConfig.haTls && !MQTT_TLS_SUPPORTED) {
+        logger("TLS is not supported by this build", "MQTT", LOG_ERROR);
+        return false;
+    }
+
+    if (mqttStoreMutex == NULL) {
+        mqttStoreMutex = xSemaphoreCreateMutex();
+    }
+
+    mqttBuildTopics();
+    mqttHaApplyConfig();
+
+#if ASYNC_TCP_SSL_ENABLED
+    mqttClientHa.setSecure(appConfig.haTls);
+    if (appConfig.haTls && strlen(appConfig.haFingerprint) == 40) {
+        static uint8_t fingerprint[20];
+        for (uint8_t i = 0; i < 20; i++) {
+            char byte[3] = {appConfig.haFingerprint[i * 2], appConfig.haFingerprint[i * 2 + 1], '\0'};
+            fingerprint[i] = strtoul(byte, NULL, 16);
+        }
+        mqttClientHa.addServerFingerprint(fingerprint);
+    }
+#endif
     mqttClientHa.onMessage(onMqttMessage);
     mqttClientHa.onConnect(onMqttConnect);
     mqttClientHa.onDisconnect(onMqttDisconnect);
+    mqttClientHa.onPublish(onMqttPublish);
 
     return true;
 }
 
 void mqttHaLoop() {
 
+    // a session stalled by a lost connection must still release the bus task
+    if (otaCheckTimeout()) {
+        mqttOtaPublishState();
+    }
+
+    // restart requested by a settings or ota command, after the reply was sent
+    if (mqttRestartAt != 0 && (long)(millis() - mqttRestartAt) >= 0) {
+        logger("Restart after remote command", "MQTT", LOG_INFO);
+        delay(100);
+        ESP.restart();
+    }
+
+    mqttHaConnectStep();
     if (!mqttClientHa.connected()) {
-        mqttHaReconnect();
+        return;
     }
 
-    // send init mqtt state
-    if (!mqttInitState) {
-        mqttHaPublish("/status", "online", true);
-        mqttHaPublish("/cover/position", String(hoermannEngine->state->currentPosition).c_str(), true);
-        mqttHaPublish("/cover/state", String(hoermannEngine->state->translatedState).c_str(), true);
-        mqttHaPublish("/light/state", (hoermannEngine->state->lightOn ? "ON" : "OFF"), true);
+    mqttStoreRetry();
 
-        checkForFirmwareUpdate();
+    // first check after connecting
+    if (!mqttInitState) {
+        // the check runs in the background so it never delays MQTT
+        submitJob(checkForFirmwareUpdate);
+        lastGhUpdateCheck = millis();
         mqttInitState = true;
     }
 
     // check if firmware update is available - only run once a day
     if (millis() - lastGhUpdateCheck >= GH_UPDATE_INTERVAL) {
         lastGhUpdateCheck = millis();
-        checkForFirmwareUpdate();
+        submitJob(checkForFirmwareUpdate);
     }
 }
 
 
 // FreeRTOS task
 void mqttTask(void *parameter) {
-    MqttMessage msg;
+    unsigned long lastHousekeeping = 0;
+    bool firstRun = true;
+
     while (true) {
-        mqttHaLoop();
+        // housekeeping (reconnect, update check) keeps its slow cadence
+        if (firstRun || millis() - lastHousekeeping >= MQTT_HOUSEKEEPING_INTERVAL) {
+            lastHousekeeping = millis();
+            firstRun = false;
+            mqttHaLoop();
+        }
+
+        if (mqttConnectedPending) {
+            mqttConnectedPending = false;
+            mqttHaResyncPending = false;
+            mqttHaOnConnected();
+        }
 
-        while (mqttQueue != NULL && xQueueReceive(mqttQueue, &msg, 0) == pdPASS) {
-            if (mqttClientHa.connected()) {
-                mqttClientHa.publish(msg.topic, 0, msg.retain, msg.payload);
+        if (mqttReconfigurePending) {
+            const uint8_t effects = mqttReconfigurePending;
+            mqttReconfigurePending = 0;
+
+            if (effects & SETTINGS_RECONNECT) {
+                // the resync runs after the reconnect
+                logger("Broker settings changed, reconnecting", "MQTT", LOG_INFO);
+                mqttHaApplyConfig();
+                mqttBackoff = MQTT_BACKOFF_MIN;
+                if (mqttClientHa.connected()) {
+                    mqttClientHa.disconnect();
+                }
+            } else if ((effects & SETTINGS_RESYNC) && mqttClientHa.connected()) {
+                mqttHaResyncPending = true;
             }
         }
-        vTaskDelay(2000);
+
+        if (mqttHaResyncPending) {
+            mqttHaResyncPending = false;
+            logger("Home Assistant online, resync", "MQTT", LOG_INFO);
+            mqttHaResync(true);
+        }
+
+        mqttStoreFlush();
+
+        // sleep until mqttHaPublish signals new values or housekeeping is due
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MQTT_HOUSEKEEPING_INTERVAL));
     }
 }
 
 void initMqttTask() {
-    if (mqttQueue == NULL) {
-        mqttQueue = xQueueCreate(20, sizeof(MqttMessage));
-    }
     if (mqttTaskHandle == NULL) {
         xTaskCreatePinnedToCore(
             mqttTask,
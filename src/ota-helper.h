@@ -0,0 +1,264 @@
+/*
+* Chunked firmware update with sequence numbers, sha256 check and resume
+*
+* Chunks arrive on the async tcp task while the timeout is checked by the MQTT task,
+* all functions take otaMutex (recursive, otaFail is also called from within).
+*/
+#include <Update.h>
+#include "mbedtls/sha256.h"
+
+#define OTA_CHUNK_MAX 4096          // max payload bytes per chunk
+#define OTA_TIMEOUT 60000           // ms without a chunk until the session is aborted
+
+extern TaskHandle_t modBusTask;
+
+enum OTA_STATE {
+    OTA_IDLE,
+    OTA_RECEIVING,
+    OTA_DONE,
+    OTA_ERROR
+};
+
+/**
+ * State of the running chunked update, chunks must arrive in order.
+ * Duplicates are ignored and gaps are reported through next so the sender can resume.
+ */
+struct OtaSession {
+    OTA_STATE state = OTA_IDLE;
+    uint32_t size = 0;                  // image size in bytes
+    uint32_t received = 0;              // bytes written
+    uint32_t next = 0;                  // next expected sequence number
+    uint8_t sha256[32];                 // expected hash of the image
+    mbedtls_sha256_context ctx;         // running hash of the written data
+    unsigned long lastChunk = 0;        // millis() of the last chunk
+    char error[48] = "";
+};
+
+OtaSession otaSession;
+SemaphoreHandle_t otaMutex = NULL;
+
+
+void otaLock() {
+    xSemaphoreTakeRecursive(otaMutex, portMAX_DELAY);
+}
+
+void otaUnlock() {
+    xSemaphoreGiveRecursive(otaMutex);
+}
+
+
+const char* otaStateName(OTA_STATE state) {
+    switch (state) {
+        case OTA_RECEIVING:
+            return "receiving";
+        case OTA_DONE:
+            return "done";
+        case OTA_ERROR:
+            return "error";
+        default:
+            return "idle";
+    }
+}
+
+
+bool otaParseHash(const char* hex, uint8_t* out) {
+    if (hex == nullptr || strlen(hex) != 64) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < 32; i++) {
+        char byte[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+        char* end;
+        out[i] = strtoul(byte, &end, 16);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void otaFail(const char* error) {
+    otaLock();
+    strncpy(otaSession.error, error, sizeof(otaSession.error) - 1);
+    otaSession.error[sizeof(otaSession.error) - 1] = '\0';
+
+    if (otaSession.state == OTA_RECEIVING) {
+        Update.abort();
+        mbedtls_sha256_free(&otaSession.ctx);
+        vTaskResume(modBusTask);
+    }
+
+    otaSession.state = OTA_ERROR;
+    otaUnlock();
+    logger("OTA failed: " + String(error), "OTA", LOG_ERROR);
+}
+
+
+/**
+ * Start a session, an identical running session (same size and hash) is resumed
+ * @return false on error, see otaSession.error
+ */
+bool otaBeginLocked(uint32_t size, const char* sha256Hex) {
+    uint8_t sha256[32];
+    if (size == 0 || !otaParseHash(sha256Hex, sha256)) {
+        otaFail("invalid begin");
+        return false;
+    }
+
+    if (otaSession.state == OTA_RECEIVING) {
+        if (otaSession.size == size && memcmp(otaSession.sha256, sha256, sizeof(sha256)) == 0) {
+            logger("OTA resumed at chunk " + String(otaSession.next), "OTA", LOG_INFO);
+            otaSession.lastChunk = millis();
+            return true;
+        }
+        otaFail("replaced by new session");
+    }
+
+    // same as the http upload: the bus task is paused while flash is written
+    vTaskSuspend(modBusTask);
+    if (!Update.begin(size)) {
+        vTaskResume(modBusTask);
+        otaFail(Update.errorString());
+        return false;
+    }
+
+    otaSession.state = OTA_RECEIVING;
+    otaSession.size = size;
+    otaSession.received = 0;
+    otaSession.next = 0;
+    otaSession.error[0] = '\0';
+    otaSession.lastChunk = millis();
+    memcpy(otaSession.sha256, sha256, sizeof(sha256));
+
+    mbedtls_sha256_init(&otaSession.ctx);
+    mbedtls_sha256_starts(&otaSession.ctx, 0);
+
+    logger("OTA started, " + String(size) + " bytes", "OTA", LOG_INFO);
+    return true;
+}
+
+
+/**
+ * Write one chunk
+ * @return true if the chunk was the expected one and got written
+ */
+bool otaWriteLocked(uint32_t seq, const uint8_t* data, size_t len) {
+    if (otaSession.state != OTA_RECEIVING) {
+        return false;
+    }
+
+    // duplicate or out of order, the sender resumes from next
+    if (seq != otaSession.next) {
+        return false;
+    }
+
+    if (len == 0 || len > OTA_CHUNK_MAX || otaSession.received + len > otaSession.size) {
+        otaFail("invalid chunk");
+        return false;
+    }
+
+    if (Update.write((uint8_t*)data, len) != len) {
+        otaFail(Update.errorString());
+        return false;
+    }
+
+    mbedtls_sha256_update(&otaSession.ctx, data, len);
+    otaSession.received += len;
+    otaSession.next++;
+    otaSession.lastChunk = millis();
+    return true;
+}
+
+
+/**
+ * Finish the session, the image is only activated if size and hash match
+ */
+bool otaEndLocked() {
+    if (otaSession.state != OTA_RECEIVING) {
+        return false;
+    }
+
+    if (otaSession.received != otaSession.size) {
+        // not complete yet, keep the session so the sender can resume
+        return false;
+    }
+
+    uint8_t sha256[32];
+    mbedtls_sha256_finish(&otaSession.ctx, sha256);
+    mbedtls_sha256_free(&otaSession.ctx);
+
+    if (memcmp(sha256, otaSession.sha256, sizeof(sha256)) != 0) {
+        Update.abort();
+        vTaskResume(modBusTask);
+        otaSession.state = OTA_ERROR;
+        strcpy(otaSession.error, "sha256 mismatch");
+        logger("OTA failed: sha256 mismatch", "OTA", LOG_ERROR);
+        return false;
+    }
+
+    if (!Update.end(true)) {
+        vTaskResume(modBusTask);
+        otaSession.state = OTA_ERROR;
+        strncpy(otaSession.error, Update.errorString(), sizeof(otaSession.error) - 1);
+        logger("OTA failed: " + String(otaSession.error), "OTA", LOG_ERROR);
+        return false;
+    }
+
+    vTaskResume(modBusTask);
+    otaSession.state = OTA_DONE;
+    logger("OTA success, " + String(otaSession.received) + " bytes written", "OTA", LOG_INFO);
+    return true;
+}
+
+
+bool otaBegin(uint32_t size, const char* sha256Hex) {
+    otaLock();
+    const bool ok = otaBeginLocked(size, sha256Hex);
+    otaUnlock();
+    return ok;
+}
+
+bool otaWrite(uint32_t seq, const uint8_t* data, size_t len) {
+    otaLock();
+    const bool ok = otaWriteLocked(seq, data, len);
+    otaUnlock();
+    return ok;
+}
+
+bool otaEnd() {
+    otaLock();
+    const bool ok = otaEndLocked();
+    otaUnlock();
+    return ok;
+}
+
+
+void initOta() {
+    if (otaMutex == NULL) {
+        otaMutex = xSemaphoreCreateRecursiveMutex();
+    }
+}
+
+
+/**
+ * Abort a stalled session, called periodically
+ * @return true if the session was aborted
+ */
+bool otaCheckTimeout() {
+    otaLock();
+    const bool timeout = otaSession.state == OTA_RECEIVING && millis() - otaSession.lastChunk >= OTA_TIMEOUT;
+    if (timeout) {
+        otaFail("timeout");
+    }
+    otaUnlock();
+    return timeout;
+}
+
+
+uint8_t otaProgress() {
+    if (otaSession.size == 0) {
+        return 0;
+    }
+    return (uint64_t)otaSession.received * 100 / otaSession.size;
+}
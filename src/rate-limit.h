@@ -0,0 +1,117 @@
+/*
+* Token bucket rate limiting per client IP and global for control, auth and OTA
+*/
+#include <ESPAsyncWebServer.h>
+
+#define RATE_CLIENTS 8              // tracked client IPs, the least recently seen is replaced
+#define RATE_CLIENT_BURST 10        // tokens per client
+#define RATE_CLIENT_REFILL 2        // tokens per second per client
+#define RATE_GLOBAL_BURST 20        // tokens shared by all clients
+#define RATE_GLOBAL_REFILL 5        // tokens per second shared by all clients
+
+// tokens per request
+#define RATE_COST_CONTROL 1
+#define RATE_COST_AUTH 2
+#define RATE_COST_OTA 5
+
+struct RateBucket {
+    uint32_t ip;
+    uint32_t tokens;                // milli tokens
+    uint32_t updated;               // millis() of the last refill
+};
+
+RateBucket rateClients[RATE_CLIENTS];
+RateBucket rateGlobal = {0, RATE_GLOBAL_BURST * 1000, 0};
+
+uint32_t rateLimited = 0;           // rejected by a client bucket
+uint32_t rateLimitedGlobal = 0;     // rejected by the global bucket
+
+
+void rateRefill(RateBucket &bucket, uint32_t burst, uint32_t refill, uint32_t now) {
+    // ms * tokens per second = milli tokens
+    const uint64_t tokens = bucket.tokens + (uint64_t)(now - bucket.updated) * refill;
+    bucket.tokens = tokens > burst * 1000 ? burst * 1000 : tokens;
+    bucket.updated = now;
+}
+
+
+RateBucket& rateClient(uint32_t ip, uint32_t now) {
+    RateBucket *oldest = &rateClients[0];
+    for (RateBucket &bucket : rateClients) {
+        if (bucket.ip == ip) {
+            return bucket;
+        }
+        if (now - bucket.updated > now - oldest->updated) {
+            oldest = &bucket;
+        }
+    }
+
+    // new clients start with a full bucket
+    oldest->ip = ip;
+    oldest->tokens = RATE_CLIENT_BURST * 1000;
+    oldest->updated = now;
+    return *oldest;
+}
+
+
+/**
+ * Take tokens from the bucket of the client and the global bucket
+ * @return false if one of them is empty, nothing is taken then
+ */
+bool rateLimitAllow(const IPAddress &remote, uint8_t cost) {
+    const uint32_t now = millis();
+    const uint32_t needed = cost * 1000;
+
+    RateBucket &client = rateClient((uint32_t)remote, now);
+    rateRefill(client, RATE_CLIENT_BURST, RATE_CLIENT_REFILL, now);
+    rateRefill(rateGlobal, RATE_GLOBAL_BURST, RATE_GLOBAL_REFILL, now);
+
+    if (client.tokens < needed) {
+        rateLimited++;
+        return false;
+    }
+    if (rateGlobal.tokens < needed) {
+        rateLimitedGlobal++;
+        return false;
+    }
+
+    client.tokens -= needed;
+    rateGlobal.tokens -= needed;
+    return true;
+}
+
+
+void sendRateLimited(AsyncWebServerRequest *request) {
+    AsyncWebServerResponse *response = request->beginResponse(429, "application/json", "{\"error\":\"rate limited\"}");
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+}
+
+
+// same matching as the route handlers, the web ui posts to "/api/auth/"
+bool rateMatches(const String &url, const char* uri) {
+    const size_t len = strlen(uri);
+    return url.startsWith(uri) && (url.length() == len || url[len] == '/');
+}
+
+
+// control and auth are checked before their handlers, OTA in the upload handlers
+void initRateLimit(AsyncWebServer &server) {
+    server.addMiddleware([](AsyncWebServerRequest *request, ArMiddlewareNext next) {
+        uint8_t cost = 0;
+        if (request->method() == HTTP_POST) {
+            if (rateMatches(request->url(), "/api/control")) {
+                cost = RATE_COST_CONTROL;
+            } else if (rateMatches(request->url(), "/api/auth")) {
+                cost = RATE_COST_AUTH;
+            }
+        }
+
+        if (cost > 0 && !rateLimitAllow(request->client()->remoteIP(), cost)) {
+            logger("Rate limited " + request->url() + " from " + request->client()->remoteIP().toString(), "HTTP", LOG_DEBUG);
+            sendRateLimited(request);
+            return;
+        }
+        next();
+    });
+}
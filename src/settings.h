@@ -0,0 +1,478 @@
+/*
+* Settings schema and the apply pipeline shared by the web forms, the json endpoint and MQTT
+*
+* All fields are validated before anything is stored, the values of a namespace are written
+* with one nvs handle and one commit. Written values are applied to appConfig in the same step.
+* nvs has no rollback, if a write fails the fields written before it stay (SETTINGS_PARTIAL).
+* Tasks read appConfig on their next cycle, so most changes take effect without a restart.
+* The returned effects tell the caller what else has to happen.
+*/
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <nvs.h>
+
+extern Preferences pref;
+extern AppConfig appConfig;
+
+enum SETTINGS_EFFECT : uint8_t {
+    SETTINGS_LIVE = 0,              // appConfig is enough
+    SETTINGS_RESYNC = 1 << 0,       // discovery changed, republish to Home Assistant
+    SETTINGS_RECONNECT = 1 << 1,    // broker connection changed, reconnect MQTT
+    SETTINGS_RESTART = 1 << 2,      // only read on boot (hostname, sensor hardware, mqtt setup)
+    SETTINGS_SYSLOG = 1 << 3        // remote log target changed, the syslog task reconnects
+};
+
+// nvs type, must match the Preferences getter used in initConfig
+enum SETTINGS_TYPE : uint8_t {
+    SETTINGS_BOOL,                  // getBool
+    SETTINGS_INT,                   // getInt
+    SETTINGS_USHORT,                // getUShort
+    SETTINGS_FLOAT,                 // getFloat
+    SETTINGS_STRING                 // getString
+};
+
+enum SETTINGS_RESULT : uint8_t {
+    SETTINGS_SAVED,                 // all fields stored and applied
+    SETTINGS_INVALID,               // json or a value is invalid, nothing stored
+    SETTINGS_UNSUPPORTED,           // value needs a feature missing in this build (tls), nothing stored
+    SETTINGS_PARTIAL,               // storing failed after some fields were written and applied
+    SETTINGS_FAILED                 // storing failed, nothing written
+};
+
+struct SettingsField {
+    const char* name;               // json and form field
+    const char* key;                // nvs key
+    SETTINGS_TYPE type;
+    double min;                     // numbers: range, strings: length
+    double max;
+    bool optional;                  // strings: empty is allowed as well (not set)
+    void* value;                    // appConfig member
+    uint8_t size;                   // size of the member
+    uint8_t effect;                 // SETTINGS_EFFECT if the value changes
+};
+
+struct SettingsSchema {
+    const char* ns;                 // nvs namespace
+    const SettingsField* fields;
+    uint8_t count;
+};
+
+#define SETTINGS_MEMBER(m) &appConfig.m, sizeof(appConfig.m)
+#define SETTINGS_JSON_MAX 2048      // max body of the bulk endpoint
+
+// restart fields are not applied to appConfig, they are used as read on boot
+const SettingsField settingsDeviceFields[] = {
+    {"name", "name", SETTINGS_STRING, 1, 64, false, SETTINGS_MEMBER(name), SETTINGS_RESTART},
+    {"lang", "lang", SETTINGS_STRING, 2, 2, false, SETTINGS_MEMBER(lang), SETTINGS_LIVE},
+    {"tempUnit", "tempUnit", SETTINGS_INT, 0, 1, false, SETTINGS_MEMBER(tempUnit), SETTINGS_LIVE},
+    {"sensorUpdateInterval", "sensorInterval", SETTINGS_INT, 500, 3600000, false, SETTINGS_MEMBER(sensorUpdateInterval), SETTINGS_LIVE},
+    {"thresholdTemp", "thresholdTemp", SETTINGS_FLOAT, 0, 100, false, SETTINGS_MEMBER(tempThreshold), SETTINGS_LIVE},
+    {"thresholdHumidity", "thresholdHum", SETTINGS_FLOAT, 0, 100, false, SETTINGS_MEMBER(humThreshold), SETTINGS_LIVE},
+    {"thresholdPressure", "thresholdPres", SETTINGS_FLOAT, 0, 1000, false, SETTINGS_MEMBER(presThreshold), SETTINGS_LIVE},
+    {"thresholdLight", "thresholdLux", SETTINGS_FLOAT, 0, 100000, false, SETTINGS_MEMBER(luxThreshold), SETTINGS_LIVE},
+    {"externalSensorSet", "extSensorSet", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(externalSensorSet), SETTINGS_RESTART},
+    {"externalSensor", "extSensor", SETTINGS_INT, 0, 5, false, SETTINGS_MEMBER(externalSensor), SETTINGS_RESTART},
+    {"combineSensors", "combineSensors", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(combineSensors), SETTINGS_LIVE},
+    {"buzzerSet", "buzzerSet", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(buzzerSet), SETTINGS_LIVE},
+    {"buzzerTune", "buzzerTune", SETTINGS_INT, 0, 3, false, SETTINGS_MEMBER(buzzerTune), SETTINGS_LIVE},
+    {"buzzerOpening", "buzzerOpening", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(buzzerOpening), SETTINGS_LIVE},
+    {"buzzerClosing", "buzzerClosing", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(buzzerClosing), SETTINGS_LIVE},
+    {"logLevel", "logLevel", SETTINGS_INT, 0, 4, false, SETTINGS_MEMBER(logLevel), SETTINGS_LIVE},
+    {"logAccess", "logAccess", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(logAccess), SETTINGS_LIVE},
+};
+
+const SettingsField settingsHaFields[] = {
+    {"activate", "activate", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(haSet), SETTINGS_RESTART},
+    {"ip", "ip", SETTINGS_STRING, 7, 15, true, SETTINGS_MEMBER(haIp), SETTINGS_RECONNECT},
+    {"port", "port", SETTINGS_INT, 1, 65535, false, SETTINGS_MEMBER(haPort), SETTINGS_RECONNECT},
+    {"user", "user", SETTINGS_STRING, 1, 32, true, SETTINGS_MEMBER(haUser), SETTINGS_RECONNECT},
+    {"pwd", "pwd", SETTINGS_STRING, 1, 63, true, SETTINGS_MEMBER(haPwd), SETTINGS_RECONNECT},
+    {"devDiscovery", "devDiscovery", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(haDeviceDiscovery), SETTINGS_RESYNC},
+    {"aggregate", "aggregate", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(haAggregate), SETTINGS_RESYNC},
+    {"keepalive", "keepalive", SETTINGS_USHORT, 5, 300, false, SETTINGS_MEMBER(haKeepAlive), SETTINGS_RECONNECT},
+    {"tls", "tls", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(haTls), SETTINGS_RESTART},
+    {"fingerprint", "fingerprint", SETTINGS_STRING, 40, 40, true, SETTINGS_MEMBER(haFingerprint), SETTINGS_RESTART},
+    {"fleet", "fleet", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(haFleet), SETTINGS_RECONNECT},
+};
+
+const SettingsField settingsSyslogFields[] = {
+    {"activate", "activate", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(syslogSet), SETTINGS_SYSLOG},
+    {"host", "host", SETTINGS_STRING, 1, 64, true, SETTINGS_MEMBER(syslogHost), SETTINGS_SYSLOG},
+    {"port", "port", SETTINGS_INT, 1, 65535, false, SETTINGS_MEMBER(syslogPort), SETTINGS_SYSLOG},
+    {"proto", "proto", SETTINGS_INT, SYSLOG_UDP, SYSLOG_RAW_UDP, false, SETTINGS_MEMBER(syslogProto), SETTINGS_SYSLOG},
+    {"local", "local", SETTINGS_BOOL, 0, 1, false, SETTINGS_MEMBER(syslogLocal), SETTINGS_LIVE},
+};
+
+const SettingsSchema settingsDevice = {"deviceSettings", settingsDeviceFields, sizeof(settingsDeviceFields) / sizeof(SettingsField)};
+const SettingsSchema settingsHa = {"haSettings", settingsHaFields, sizeof(settingsHaFields) / sizeof(SettingsField)};
+const SettingsSchema settingsSyslog = {"syslog", settingsSyslogFields, sizeof(settingsSyslogFields) / sizeof(SettingsField)};
+
+void mqttHaReconfigure(uint8_t effects);
+
+
+const SettingsField* settingsFind(const SettingsSchema &schema, const char* name) {
+    for (uint8_t i = 0; i < schema.count; i++) {
+        if (strcmp(schema.fields[i].name, name) == 0) {
+            return &schema.fields[i];
+        }
+    }
+    return nullptr;
+}
+
+
+/**
+ * Convert and check a value, json types and their form representation are accepted
+ * @return false if the value has the wrong type or is out of range
+ */
+bool settingsParse(const SettingsField &field, JsonVariantConst v, double &number, const char* &text) {
+    text = v.is<const char*>() ? v.as<const char*>() : nullptr;
+
+    if (field.type == SETTINGS_STRING) {
+        if (text == nullptr) {
+            return false;
+        }
+        const size_t len = strlen(text);
+        return (len == 0 && field.optional) || (len >= field.min && len <= field.max);
+    }
+
+    if (field.type == SETTINGS_BOOL) {
+        if (v.is<bool>()) {
+            number = v.as<bool>();
+        } else if (text != nullptr && (strcmp(text, "true") == 0 || strcmp(text, "1") == 0)) {
+            number = 1;
+        } else if (text != nullptr && (strcmp(text, "false") == 0 || strcmp(text, "0") == 0)) {
+            number = 0;
+        } else if (v.is<int>() && (v.as<int>() == 0 || v.as<int>() == 1)) {
+            number = v.as<int>();
+        } else {
+            return false;
+        }
+
+    } else if (text != nullptr) {
+        char* end;
+        number = strtod(text, &end);
+        if (end == text || *end != '\0') {
+            return false;
+        }
+
+    } else if (v.is<double>()) {
+        number = v.as<double>();
+
+    } else {
+        return false;
+    }
+
+    if (field.type != SETTINGS_FLOAT && number != (int32_t)number) {
+        return false;
+    }
+    return number >= field.min && number <= field.max;
+}
+
+
+double settingsGet(const SettingsField &field) {
+    switch (field.type) {
+        case SETTINGS_BOOL:
+            return *(bool*)field.value;
+        case SETTINGS_FLOAT:
+            return *(float*)field.value;
+        default:
+            break;
+    }
+
+    // integers in members of different size
+    if (field.size == 1) {
+        return *(uint8_t*)field.value;
+    } else if (field.size == 2) {
+        return *(uint16_t*)field.value;
+    }
+    return *(uint32_t*)field.value;
+}
+
+
+void settingsSet(const SettingsField &field, double number, const char* text) {
+    switch (field.type) {
+        case SETTINGS_STRING:
+            strlcpy((char*)field.value, text, field.size);
+            return;
+        case SETTINGS_BOOL:
+            *(bool*)field.value = number != 0;
+            return;
+        case SETTINGS_FLOAT:
+            *(float*)field.value = number;
+            return;
+        default:
+            break;
+    }
+
+    if (field.size == 1) {
+        *(uint8_t*)field.value = number;
+    } else if (field.size == 2) {
+        *(uint16_t*)field.value = number;
+    } else {
+        *(uint32_t*)field.value = number;
+    }
+}
+
+
+bool settingsChanged(const SettingsField &field, double number, const char* text) {
+    if (field.type == SETTINGS_STRING) {
+        return strcmp((const char*)field.value, text) != 0;
+    }
+    return settingsGet(field) != (field.type == SETTINGS_FLOAT ? (float)number : number);
+}
+
+
+// same encoding as the Preferences put* calls
+esp_err_t settingsWrite(nvs_handle_t handle, const SettingsField &field, double number, const char* text) {
+    switch (field.type) {
+        case SETTINGS_BOOL:
+            return nvs_set_u8(handle, field.key, number != 0);
+        case SETTINGS_INT:
+            return nvs_set_i32(handle, field.key, number);
+        case SETTINGS_USHORT:
+            return nvs_set_u16(handle, field.key, number);
+        case SETTINGS_FLOAT: {
+            const float value = number;
+            return nvs_set_blob(handle, field.key, &value, sizeof(value));
+        }
+        default:
+            return nvs_set_str(handle, field.key, text);
+    }
+}
+
+
+// values that are valid but cannot work with this build
+bool settingsSupported(const SettingsField &field, double number) {
+    if (field.value == &appConfig.haTls && number != 0 && !MQTT_TLS_SUPPORTED) {
+        logger("TLS is not supported by this build (needs ASYNC_TCP_SSL_ENABLED)", "Settings", LOG_ERROR);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Check all fields before anything is stored, unknown fields are ignored
+ * @return number of known fields, -1 if a value is invalid, -2 if it is not supported
+ */
+int settingsValidate(const SettingsSchema &schema, JsonObjectConst obj) {
+    int count = 0;
+    for (JsonPairConst kv : obj) {
+        const SettingsField *field = settingsFind(schema, kv.key().c_str());
+        if (field == nullptr) {
+            logger("Unknown setting: " + String(kv.key().c_str()), "Settings", LOG_WARNING);
+            continue;
+        }
+
+        double number;
+        const char* text;
+        if (!settingsParse(*field, kv.value(), number, text)) {
+            logger("Invalid setting: " + String(field->name), "Settings", LOG_WARNING);
+            return -1;
+        }
+        if (!settingsSupported(*field, number)) {
+            return -2;
+        }
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * Write validated fields with a single commit, then apply the written ones to appConfig
+ * nvs_set_* already reaches the flash, so fields written before a failed write are kept
+ * and applied as well, appConfig always matches what is stored.
+ */
+SETTINGS_RESULT settingsStore(const SettingsSchema &schema, JsonObjectConst obj, uint8_t &effects) {
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(schema.ns, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        logger("Storing settings failed: " + String(esp_err_to_name(err)), "Settings", LOG_ERROR);
+        return SETTINGS_FAILED;
+    }
+
+    int written = 0;
+    for (JsonPairConst kv : obj) {
+        const SettingsField *field = settingsFind(schema, kv.key().c_str());
+        double number;
+        const char* text;
+        if (field != nullptr && settingsParse(*field, kv.value(), number, text)) {
+            err = settingsWrite(handle, *field, number, text);
+            if (err != ESP_OK) {
+                break;
+            }
+            written++;
+        }
+    }
+
+    if (written > 0) {
+        const esp_err_t commitErr = nvs_commit(handle);
+        if (err == ESP_OK) {
+            err = commitErr;
+        }
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        logger("Storing settings failed after " + String(written) + " fields: " + String(esp_err_to_name(err)), "Settings", LOG_ERROR);
+    }
+
+    int applied = 0;
+    for (JsonPairConst kv : obj) {
+        if (applied == written) {
+            break;
+        }
+        const SettingsField *field = settingsFind(schema, kv.key().c_str());
+        double number;
+        const char* text;
+        if (field == nullptr || !settingsParse(*field, kv.value(), number, text)) {
+            continue;
+        }
+
+        applied++;
+        if (!settingsChanged(*field, number, text)) {
+            continue;
+        }
+        effects |= field->effect;
+        if (field->effect != SETTINGS_RESTART) {
+            settingsSet(*field, number, text);
+        }
+    }
+
+    if (err == ESP_OK) {
+        return SETTINGS_SAVED;
+    }
+    return written > 0 ? SETTINGS_PARTIAL : SETTINGS_FAILED;
+}
+
+
+/**
+ * Validate, store and apply the fields of one namespace
+ * @return SETTINGS_INVALID if a value is invalid, nothing is stored then
+ */
+SETTINGS_RESULT settingsApply(const SettingsSchema &schema, JsonObjectConst obj, uint8_t &effects) {
+    const int count = settingsValidate(schema, obj);
+    if (count < 0) {
+        return count == -2 ? SETTINGS_UNSUPPORTED : SETTINGS_INVALID;
+    }
+    if (count == 0) {
+        return SETTINGS_SAVED;
+    }
+
+    const bool logAccess = appConfig.logAccess;
+    const SETTINGS_RESULT result = settingsStore(schema, obj, effects);
+
+    // if loggging is set to false delete the existing file
+    if (logAccess && !appConfig.logAccess) {
+        deleteLogFile("/log-access.txt");
+    }
+    return result;
+}
+
+
+// current values of all fields, used for the GET endpoints
+void settingsToJson(const SettingsSchema &schema, JsonObject obj) {
+    for (uint8_t i = 0; i < schema.count; i++) {
+        const SettingsField &field = schema.fields[i];
+
+        switch (field.type) {
+            case SETTINGS_STRING:
+                obj[field.name] = (const char*)field.value;
+                break;
+            case SETTINGS_BOOL:
+                obj[field.name] = *(bool*)field.value;
+                break;
+            case SETTINGS_FLOAT:
+                obj[field.name] = *(float*)field.value;
+                break;
+            default:
+                obj[field.name] = (uint32_t)settingsGet(field);
+                break;
+        }
+    }
+}
+
+
+/**
+ * Bump the versions of cached responses and hand the side effects to the subsystems
+ * @return true if a restart is required
+ */
+bool settingsCommit(uint8_t effects) {
+    settingsTouch();
+    statusTouch();
+
+    if (effects & SETTINGS_RESTART) {
+        return true;
+    }
+
+    if (effects & (SETTINGS_RESYNC | SETTINGS_RECONNECT)) {
+        mqttHaReconfigure(effects);
+    }
+    if (effects & SETTINGS_SYSLOG) {
+        syslogReconfigure();
+    }
+    return false;
+}
+
+
+/**
+ * Apply device settings from a json object, e.g. {"tempUnit":1,"buzzerSet":false}
+ */
+SETTINGS_RESULT settingsApplyDeviceJson(const char* json, size_t len, uint8_t &effects) {
+    JsonDocument doc;
+    if (deserializeJson(doc, json, len) || !doc.is<JsonObject>()) {
+        return SETTINGS_INVALID;
+    }
+    return settingsApply(settingsDevice, doc.as<JsonObjectConst>(), effects);
+}
+
+
+/**
+ * Apply several namespaces at once, e.g. {"device":{"logLevel":2},"ha":{"keepalive":30}}
+ * Every section is validated before the first one is stored, then all sections are written
+ * even if an earlier one failed. The caller commits the effects unless SETTINGS_INVALID/FAILED.
+ */
+SETTINGS_RESULT settingsApplyJson(const char* json, size_t len, uint8_t &effects) {
+    JsonDocument doc;
+    if (deserializeJson(doc, json, len) || !doc.is<JsonObject>()) {
+        return SETTINGS_INVALID;
+    }
+
+    const JsonObjectConst device = doc["device"].as<JsonObjectConst>();
+    const JsonObjectConst ha = doc["ha"].as<JsonObjectConst>();
+    const int countDevice = settingsValidate(settingsDevice, device);
+    const int countHa = settingsValidate(settingsHa, ha);
+    if (countDevice == -2 || countHa == -2) {
+        return SETTINGS_UNSUPPORTED;
+    }
+    if (countDevice < 0 || countHa < 0) {
+        return SETTINGS_INVALID;
+    }
+    if (countHa == 0) {
+        return settingsApply(settingsDevice, device, effects);
+    }
+    if (countDevice == 0) {
+        return settingsApply(settingsHa, ha, effects);
+    }
+
+    const SETTINGS_RESULT resultDevice = settingsApply(settingsDevice, device, effects);
+    const SETTINGS_RESULT resultHa = settingsApply(settingsHa, ha, effects);
+    if (resultDevice == resultHa) {
+        return resultDevice;
+    }
+
+    // one section stored, the other one failed
+    return SETTINGS_PARTIAL;
+}
+
+
+// stored with putInt by earlier firmware, which dropped the decimals
+void settingsMigrateFloat(const char* key) {
+    if (pref.getType(key) == PT_I32) {
+        const float value = pref.getInt(key);
+        pref.remove(key);
+        pref.putFloat(key, value);
+        logger("Migrated setting " + String(key) + " to float", "Settings", LOG_INFO);
+    }
+}
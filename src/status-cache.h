@@ -0,0 +1,85 @@
+/*
+* Pre-serialized /api/status, rebuilt only when the state version changed
+*/
+#define STATUS_CACHE_LEN 1024       // max size of the serialized status
+
+extern AppConfig appConfig;
+
+char statusCacheJson[STATUS_CACHE_LEN];
+size_t statusCacheLen = 0;
+uint32_t statusCacheVersion = 0;
+bool statusCacheValid = false;
+bool statusCacheOverflow = false;   // logged once, the status is serialized directly then
+
+uint32_t statusCacheBuilds = 0;
+uint32_t statusCacheHits = 0;
+
+
+void statusBuild(JsonDocument &doc) {
+    const int doorCurrentPosition = (int)(hoermannEngine->state->currentPosition * 100);
+    const int doorTargetPosition = (int)(hoermannEngine->state->targetPosition * 100);
+
+    JsonObject door = doc["door"].to<JsonObject>();
+    door["position_current"] = doorCurrentPosition;
+    door["position_target"] = doorTargetPosition;
+    door["state"] = hoermannEngine->state->translatedState;
+    door["moving"] = doorCurrentPosition != doorTargetPosition;
+    door["light"] = hoermannEngine->state->lightOn;
+
+    JsonObject sensor = doc["sensor"].to<JsonObject>();
+    sensor["temperature"] = appConfig.temperature;
+    sensor["humidity"] = appConfig.humidity;
+    sensor["pressure"] = appConfig.pressure;
+    sensor["lux"] = appConfig.lux;
+    sensor["combineSensors"] = appConfig.combineSensors;
+
+    // if exxternal sensor is set, add it to the response
+    if (appConfig.externalSensorSet) {
+        sensor["externalSensor"] = appConfig.externalSensor;
+        sensor["extSensorData"] = appConfig.extSensorData;
+    } else {
+        sensor["externalSensor"] = "none";
+    }
+
+    doc["status"] = "ok";
+    doc["version_fw"] = VERSION;
+}
+
+
+/**
+ * Copy the current status json, the cache is rebuilt first if the state changed
+ * @param version   state version the copy was built from
+ * @return length of the terminated copy, 0 if the status does not fit, use statusBuild then
+ */
+size_t statusSnapshot(char* buf, size_t size, uint32_t &version) {
+    xSemaphoreTake(statusCacheMutex, portMAX_DELAY);
+
+    const uint32_t current = stateVersion;
+    if (!statusCacheValid || statusCacheVersion != current) {
+        JsonDocument doc;
+        statusBuild(doc);
+        statusCacheLen = measureJson(doc);
+        if (statusCacheLen < sizeof(statusCacheJson)) {
+            serializeJson(doc, statusCacheJson, sizeof(statusCacheJson));
+        } else {
+            if (!statusCacheOverflow) {
+                logger("Status exceeds " + String(STATUS_CACHE_LEN) + " bytes, not cached", "Status", LOG_WARNING);
+                statusCacheOverflow = true;
+            }
+            statusCacheLen = 0;
+        }
+        statusCacheVersion = current;
+        statusCacheValid = true;
+        statusCacheBuilds++;
+    } else {
+        statusCacheHits++;
+    }
+
+    const size_t len = statusCacheLen < size ? statusCacheLen : 0;
+    memcpy(buf, statusCacheJson, len);
+    buf[len] = '\0';
+    version = statusCacheVersion;
+
+    xSemaphoreGive(statusCacheMutex);
+    return len;
+}
@@ -0,0 +1,32 @@
+/*
+* Version counters for cached and conditional responses
+*/
+#include <esp_random.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// random per boot, so versions of an earlier boot never match
+uint32_t bootId = 0;
+
+// incremented whenever door or sensor values change
+volatile uint32_t stateVersion = 0;
+
+// incremented whenever settings are applied without a restart
+volatile uint32_t settingsVersion = 0;
+
+// guards the pre-serialized status in status-cache.h
+SemaphoreHandle_t statusCacheMutex = NULL;
+
+
+void statusTouch() {
+    stateVersion++;
+}
+
+void settingsTouch() {
+    settingsVersion++;
+}
+
+void initStatus() {
+    bootId = esp_random();
+    statusCacheMutex = xSemaphoreCreateMutex();
+}
@@ -0,0 +1,266 @@
+/*
+* Forwarding of log messages to a remote syslog server or plain UDP collector
+*/
+#include <WiFiUdp.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#define SYSLOG_QUEUE_LEN 32         // messages buffered while WiFi is down
+#define SYSLOG_BATCH_LEN 1200       // max bytes per datagram or TCP write
+#define SYSLOG_BATCH_DELAY 500      // ms to collect messages before a batch is sent
+#define SYSLOG_RATE 20              // messages per second
+#define SYSLOG_BURST 40             // max messages sent in one burst
+#define SYSLOG_RETRY_DELAY 5000     // ms to wait after a failed connect / resolve
+
+extern AppConfig appConfig;
+
+enum SYSLOG_PROTO {
+    SYSLOG_UDP,         // RFC 5424 over UDP (RFC 5426), one message per datagram
+    SYSLOG_TCP,         // RFC 5424 over TCP with octet counting (RFC 6587)
+    SYSLOG_RAW_UDP      // plain csv lines, batched into one datagram
+};
+
+QueueHandle_t syslogQueue = NULL;
+TaskHandle_t syslogTaskHandle = NULL;
+
+WiFiUDP syslogUdp;
+WiFiClient syslogTcp;
+IPAddress syslogIp;
+
+uint32_t syslogSent = 0;
+uint32_t syslogDropped = 0;
+
+// set when host, port or protocol changed, handled by the syslog task
+volatile bool syslogReconfigurePending = false;
+
+
+// called from the log task for every log entry
+void syslogForward(const LogMessage &msg) {
+    if (syslogQueue == NULL) {
+        return;
+    }
+
+    // buffer full (e.g. WiFi down): drop the oldest entry to keep the newest
+    if (xQueueSend(syslogQueue, &msg, 0) != pdPASS) {
+        LogMessage oldest;
+        xQueueReceive(syslogQueue, &oldest, 0);
+        xQueueSend(syslogQueue, &msg, 0);
+        syslogDropped++;
+    }
+}
+
+
+// map internal log levels to syslog severities
+uint8_t syslogSeverity(uint8_t level) {
+    switch (level) {
+        case LOG_ERROR:
+            return 3;
+        case LOG_WARNING:
+            return 4;
+        case LOG_INFO:
+            return 6;
+        default:
+            return 7;
+    }
+}
+
+
+// format a single log entry, returns the length written
+int syslogFormat(const LogMessage &msg, char *out, size_t outLen) {
+    if (appConfig.syslogProto == SYSLOG_RAW_UDP) {
+        return snprintf(out, outLen, "%s;%s\n", appConfig.name, msg.data);
+    }
+
+    // access log goes to facility auth (4), everything else to local0 (16)
+    const uint8_t facility = strcmp(msg.fileName, "/log-access.txt") == 0 ? 4 : 16;
+    const uint8_t pri = facility * 8 + syslogSeverity(msg.level);
+
+    char timestamp[25] = "-";
+    if (msg.timestamp > 1600000000) {
+        struct tm t;
+        gmtime_r(&msg.timestamp, &t);
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &t);
+    }
+
+    // syslog fields must not contain spaces
+    char hostname[65];
+    strncpy(hostname, appConfig.name, sizeof(hostname) - 1);
+    hostname[sizeof(hostname) - 1] = '\0';
+    for (char *c = hostname; *c; c++) {
+        if (*c == ' ') {
+            *c = '_';
+        }
+    }
+
+    char msgId[sizeof(msg.tag)];
+    strcpy(msgId, msg.tag[0] != '\0' ? msg.tag : "-");
+    for (char *c = msgId; *c; c++) {
+        if (*c == ' ') {
+            *c = '_';
+        }
+    }
+
+    // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD MSG
+    return snprintf(out, outLen, "<%u>1 %s %s pandagarage - %s - %s", pri, timestamp, hostname, msgId, msg.data + msg.bodyOffset);
+}
+
+
+bool syslogResolve() {
+    if (syslogIp != IPAddress(0, 0, 0, 0)) {
+        return true;
+    }
+
+    if (!WiFi.hostByName(appConfig.syslogHost, syslogIp)) {
+        syslogIp = IPAddress(0, 0, 0, 0);
+        return false;
+    }
+    return true;
+}
+
+
+bool syslogSendUdp(const char *data, size_t len) {
+    if (!syslogUdp.beginPacket(syslogIp, appConfig.syslogPort)) {
+        return false;
+    }
+    syslogUdp.write((const uint8_t *)data, len);
+    return syslogUdp.endPacket() == 1;
+}
+
+
+void syslogTask(void *parameter) {
+    static char batch[SYSLOG_BATCH_LEN];
+    char line[LOG_MSG_LEN + 128];
+    LogMessage msg;
+
+    uint32_t tokens = SYSLOG_BURST;
+    unsigned long lastRefill = millis();
+
+    while (true) {
+        // block until there is something to send
+        if (xQueuePeek(syslogQueue, &msg, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        // target changed via settings, resolve and connect again
+        if (syslogReconfigurePending) {
+            syslogReconfigurePending = false;
+            syslogTcp.stop();
+            syslogIp = IPAddress(0, 0, 0, 0);
+        }
+
+        // keep buffering while offline
+        if (WiFi.status() != WL_CONNECTED) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        if (!syslogResolve()) {
+            vTaskDelay(pdMS_TO_TICKS(SYSLOG_RETRY_DELAY));
+            continue;
+        }
+
+        if (appConfig.syslogProto == SYSLOG_TCP && !syslogTcp.connected()) {
+            syslogTcp.stop();
+            if (!syslogTcp.connect(syslogIp, appConfig.syslogPort, 2000)) {
+                // server gone or address changed, resolve again on next try
+                syslogIp = IPAddress(0, 0, 0, 0);
+                vTaskDelay(pdMS_TO_TICKS(SYSLOG_RETRY_DELAY));
+                continue;
+            }
+        }
+
+        // give further messages a moment to arrive so they go out in one batch
+        vTaskDelay(pdMS_TO_TICKS(SYSLOG_BATCH_DELAY));
+
+        // refill rate limit tokens, only the time turned into tokens is consumed
+        unsigned long now = millis();
+        const uint32_t refill = (now - lastRefill) * SYSLOG_RATE / 1000;
+        if (refill > 0) {
+            lastRefill += refill * 1000 / SYSLOG_RATE;
+            tokens = min((uint32_t)SYSLOG_BURST, tokens + refill);
+        }
+        if (tokens == SYSLOG_BURST) {
+            // a full bucket does not bank time
+            lastRefill = now;
+        }
+        if (tokens == 0) {
+            vTaskDelay(pdMS_TO_TICKS(1000 / SYSLOG_RATE));
+            continue;
+        }
+
+        size_t used = 0;
+        uint32_t batched = 0;
+        while (tokens > 0 && xQueuePeek(syslogQueue, &msg, 0) == pdPASS) {
+            int len = syslogFormat(msg, line, sizeof(line));
+            len = min(len, (int)sizeof(line) - 1);
+
+            if (appConfig.syslogProto == SYSLOG_UDP) {
+                if (len <= 0) {
+                    syslogDropped++;
+                } else if (syslogSendUdp(line, len)) {
+                    syslogSent++;
+                } else {
+                    break;
+                }
+
+            } else {
+                char prefix[8] = "";
+                int prefixLen = 0;
+                if (appConfig.syslogProto == SYSLOG_TCP) {
+                    prefixLen = snprintf(prefix, sizeof(prefix), "%d ", len);
+                }
+
+                if (used + prefixLen + len > sizeof(batch)) {
+                    break;
+                }
+                memcpy(batch + used, prefix, prefixLen);
+                memcpy(batch + used + prefixLen, line, len);
+                used += prefixLen + len;
+                batched++;
+            }
+
+            xQueueReceive(syslogQueue, &msg, 0);
+            tokens--;
+        }
+
+        if (used > 0) {
+            bool ok;
+            if (appConfig.syslogProto == SYSLOG_TCP) {
+                ok = syslogTcp.write((const uint8_t *)batch, used) == used;
+            } else {
+                ok = syslogSendUdp(batch, used);
+            }
+
+            if (ok) {
+                syslogSent += batched;
+            } else {
+                syslogDropped += batched;
+                syslogTcp.stop();
+            }
+        }
+    }
+}
+
+
+void initSyslog() {
+    if (!appConfig.syslogSet || strlen(appConfig.syslogHost) == 0) {
+        appConfig.syslogSet = false;
+        return;
+    }
+
+    if (syslogQueue == NULL) {
+        syslogQueue = xQueueCreate(SYSLOG_QUEUE_LEN, sizeof(LogMessage));
+    }
+
+    if (syslogTaskHandle == NULL) {
+        xTaskCreatePinnedToCore(syslogTask, "SyslogTask", 4096, NULL, 1, &syslogTaskHandle, 1);
+    }
+}
+
+
+// settings changed at runtime, starts the task if forwarding was just enabled
+void syslogReconfigure() {
+    syslogReconfigurePending = true;
+    initSyslog();
+}
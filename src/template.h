@@ -0,0 +1,240 @@
+/*
+* HTML templates compiled once at boot into literal segments and placeholder ids
+*/
+#include <LittleFS.h>
+
+#define TPL_MAX_SEGMENTS 32     // max placeholders per template
+#define TPL_MAX_NAME 32         // max placeholder name length
+
+enum TPL_VAR : uint8_t {
+    TPL_END,                    // last literal, no placeholder follows
+    TPL_DEVICE_NAME,
+    TPL_WIFI_ICON,
+    TPL_WIFI_SIGNAL,
+    TPL_IP,
+    TPL_MAC,
+    TPL_UPTIME,
+    TPL_LOCAL_TIME,
+    TPL_VERSION_FW,
+    TPL_VERSION_FS,
+    TPL_VERSION_HW,
+    TPL_DEVICE_SERIAL,
+    TPL_RESTART_REASON
+};
+
+static const char* const tplNames[] = {
+    "",
+    "TEMPLATE_DEVICE_NAME",
+    "TEMPLATE_WIFI_ICON",
+    "TEMPLATE_WIFI_SIGNAL",
+    "TEMPLATE_IP",
+    "TEMPLATE_MAC",
+    "TEMPLATE_UPTIME",
+    "TEMPLATE_LOCAL_TIME",
+    "TEMPLATE_VERSION_FW",
+    "TEMPLATE_VERSION_FS",
+    "TEMPLATE_VERSION_HW",
+    "TEMPLATE_DEVICE_SERIAL",
+    "TEMPLATE_RESTART_REASON",
+};
+
+/**
+ * Literal text [offset, offset + length) followed by a placeholder
+ */
+struct TplSegment {
+    uint16_t offset;
+    uint16_t length;
+    uint8_t var;                // TPL_VAR
+};
+
+struct CompiledTemplate {
+    char* text = nullptr;       // file content, placeholders are skipped via the segments
+    TplSegment segments[TPL_MAX_SEGMENTS + 1];
+    uint8_t count = 0;
+};
+
+CompiledTemplate infoTemplate;
+
+uint32_t tplRenderLastUs = 0;
+uint32_t tplRenderMaxUs = 0;
+
+
+uint8_t tplLookup(const char* name, size_t len) {
+    for (uint8_t i = 1; i < sizeof(tplNames) / sizeof(tplNames[0]); i++) {
+        if (strlen(tplNames[i]) == len && memcmp(tplNames[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return TPL_END;
+}
+
+
+/**
+ * Split a template file into literals and placeholders (%NAME%), "%%" is a literal %
+ * @return false if the file is missing or has too many placeholders
+ */
+bool compileTemplate(const char* path, CompiledTemplate &tpl) {
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    const size_t size = file.size();
+    free(tpl.text);
+    tpl.text = (char*)malloc(size + 1);
+    if (tpl.text == nullptr) {
+        file.close();
+        return false;
+    }
+    file.read((uint8_t*)tpl.text, size);
+    file.close();
+    tpl.text[size] = '\0';
+
+    // literals are compacted in place, "%%" and the placeholders are removed
+    size_t in = 0;
+    size_t out = 0;
+    size_t start = 0;
+    tpl.count = 0;
+
+    while (in < size) {
+        if (tpl.text[in] != '%') {
+            tpl.text[out++] = tpl.text[in++];
+            continue;
+        }
+
+        if (tpl.text[in + 1] == '%') {
+            tpl.text[out++] = '%';
+            in += 2;
+            continue;
+        }
+
+        // %NAME% with a known name, anything else (e.g. "width: 30%") stays literal
+        size_t end = in + 1;
+        while (end < size && end - in <= TPL_MAX_NAME && (isupper(tpl.text[end]) || isdigit(tpl.text[end]) || tpl.text[end] == '_')) {
+            end++;
+        }
+
+        const uint8_t var = (end < size && tpl.text[end] == '%') ? tplLookup(tpl.text + in + 1, end - in - 1) : TPL_END;
+        if (var == TPL_END) {
+            tpl.text[out++] = tpl.text[in++];
+            continue;
+        }
+
+        if (tpl.count >= TPL_MAX_SEGMENTS) {
+            logger("Too many placeholders in " + String(path), "HTTP", LOG_ERROR);
+            free(tpl.text);
+            tpl.text = nullptr;
+            return false;
+        }
+
+        tpl.segments[tpl.count++] = {(uint16_t)start, (uint16_t)(out - start), var};
+        start = out;
+        in = end + 1;
+    }
+
+    tpl.segments[tpl.count++] = {(uint16_t)start, (uint16_t)(out - start), TPL_END};
+    return true;
+}
+
+
+void renderUptime(Print &out) {
+    const unsigned long seconds = millis() / 1000;
+    out.printf("%lu days %luh %02lumin %02lus", seconds / 86400, (seconds / 3600) % 24, (seconds / 60) % 60, seconds % 60);
+}
+
+
+/**
+ * Render info.html, values that are used more than once are read only once
+ */
+void renderInfoTemplate(AsyncWebServerRequest *request) {
+    const unsigned long start = micros();
+    const int rssi = WiFi.RSSI();
+
+    AsyncResponseStream *response = request->beginResponseStream("text/html");
+
+    for (uint8_t i = 0; i < infoTemplate.count; i++) {
+        const TplSegment &seg = infoTemplate.segments[i];
+        response->write((const uint8_t*)infoTemplate.text + seg.offset, seg.length);
+
+        switch (seg.var) {
+            case TPL_DEVICE_NAME:
+                response->print(appConfig.name);
+                break;
+
+            case TPL_WIFI_ICON:
+                if (rssi > -50) {
+                    response->print("assets/img/wifi-3.svg");
+                } else if (rssi > -65) {
+                    response->print("assets/img/wifi-2.svg");
+                } else if (rssi > -80) {
+                    response->print("assets/img/wifi-1.svg");
+                } else {
+                    response->print("assets/img/wifi-0.svg");
+                }
+                break;
+
+            case TPL_WIFI_SIGNAL:
+                response->print(rssi);
+                break;
+
+            case TPL_IP:
+                response->print(WiFi.localIP());
+                break;
+
+            case TPL_MAC:
+                response->print(WiFi.macAddress());
+                break;
+
+            case TPL_UPTIME:
+                renderUptime(*response);
+                break;
+
+            case TPL_LOCAL_TIME: {
+                // do not wait for a time sync
+                struct tm now;
+                char timeStr[32] = "-";
+                if (getLocalTime(&now, 0)) {
+                    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S UTC", &now);
+                }
+                response->print(timeStr);
+                break;
+            }
+
+            case TPL_VERSION_FW:
+                response->print(VERSION);
+                break;
+
+            case TPL_VERSION_FS:
+                response->print(appConfig.versionFs);
+                break;
+
+            case TPL_VERSION_HW:
+                response->print(appConfig.hwRev);
+                break;
+
+            case TPL_DEVICE_SERIAL:
+                response->print(appConfig.serialNumber);
+                break;
+
+            case TPL_RESTART_REASON:
+                response->print(restartReasonString(esp_reset_reason()));
+                break;
+        }
+    }
+
+    tplRenderLastUs = micros() - start;
+    tplRenderMaxUs = max(tplRenderMaxUs, tplRenderLastUs);
+
+    char timing[32];
+    snprintf(timing, sizeof(timing), "render;dur=%.2f", tplRenderLastUs / 1000.0);
+    response->addHeader("Server-Timing", timing);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+
+void initTemplates() {
+    if (!compileTemplate("/info.html", infoTemplate)) {
+        logger("Failed to compile info.html", "HTTP", LOG_ERROR);
+    }
+}
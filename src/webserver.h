@@ -10,6 +10,7 @@ extern AppConfig appConfig;
 bool updateInProgress = false;
 volatile int lastReportedPct = 0;
 volatile int currentPct = 0;
+bool otaRateLimited = false;
 
 
 // Auth Middleware
@@ -23,80 +24,14 @@ bool isAuthorized(AsyncWebServerRequest* request) {
         return false;
     }
 
-    String hash = request->getHeader("Authorization")->value();
-    if (!verifyPasswordHash(hash)) {
+    String token = request->getHeader("Authorization")->value();
+    if (authVerify(token) == nullptr) {
         request->send(403, "application/json", "{\"error\":\"invalid auth\"}");
         return false;
     }
     return true;
 }
 
-String processorInfo(const String &var) {
-    if (var == "TEMPLATE_DEVICE_NAME") {
-        return appConfig.name;
-
-    } else if (var == "TEMPLATE_WIFI_ICON") {
-        if (WiFi.RSSI() > -50) {
-            return String("assets/img/wifi-3.svg");
-        } else if (WiFi.RSSI() > -65) {
-            return String("assets/img/wifi-2.svg");
-        } else if (WiFi.RSSI() > -80) {
-            return String("assets/img/wifi-1.svg");
-        } else {
-            return String("assets/img/wifi-0.svg");
-        }
-
-    } else if (var == "TEMPLATE_WIFI_SIGNAL") {
-        return String(WiFi.RSSI());
-
-    } else if (var == "TEMPLATE_IP") {
-        return WiFi.localIP().toString();
-
-    } else if (var == "TEMPLATE_MAC") {
-        return WiFi.macAddress();
-
-    } else if (var == "TEMPLATE_UPTIME") {
-        unsigned long uptimeMillis = millis();
-
-        unsigned long seconds = uptimeMillis / 1000;
-        unsigned long minutes = seconds / 60;
-        unsigned long hours = minutes / 60;
-        unsigned long days = hours / 24;
-
-        seconds = seconds % 60;
-        minutes = minutes % 60;
-        hours = hours % 24;
-
-        String uptime = String(days) + " days " + String(hours) + "h " + (minutes < 10 ? "0" : "") + String(minutes) + "min " + (seconds < 10 ? "0" : "") + String(seconds) + "s";
-        return uptime;
-
-    } else if (var == "TEMPLATE_LOCAL_TIME") {
-        getLocalTime(&timeinfo);
-
-        char timeStr[64];
-        strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &timeinfo);
-
-        return String(timeStr) + " UTC";
-
-    } else if (var == "TEMPLATE_VERSION_FW") {
-        return VERSION;
-
-    } else if (var == "TEMPLATE_VERSION_FS") {
-        return F(appConfig.versionFs);
-
-    } else if (var == "TEMPLATE_VERSION_HW") {
-        return appConfig.hwRev;
-
-    } else if (var == "TEMPLATE_DEVICE_SERIAL") {
-        return appConfig.serialNumber;
-
-    } else if (var == "TEMPLATE_RESTART_REASON") {
-        return restartReasonString(esp_reset_reason());
-    }
-
-    return String();
-}
-
 String processorLogs(const String &var) {
     if (var == "LOG_ACCESS_TEMPLATE") {
         // check if logging is even active
@@ -137,6 +72,13 @@ String processorLogs(const String &var) {
 void handleOtaFw(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
     static size_t totalSize = 0;
 
+    if (index == 0) {
+        otaRateLimited = !rateLimitAllow(request->client()->remoteIP(), RATE_COST_OTA);
+    }
+    if (otaRateLimited) {
+        return;
+    }
+
     if (index == 0) {
         vTaskSuspend(modBusTask);
         logger("OTA Firmware update start: " + filename, "Device", LOG_INFO);
@@ -195,6 +137,13 @@ void handleOtaFw(AsyncWebServerRequest *request, const String &filename, size_t
 void handleOtaFs(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final) {
     static size_t totalSize = 0;
 
+    if (index == 0) {
+        otaRateLimited = !rateLimitAllow(request->client()->remoteIP(), RATE_COST_OTA);
+    }
+    if (otaRateLimited) {
+        return;
+    }
+
     if (index == 0) {
         vTaskSuspend(modBusTask);
         logger("OTA Filesystem update start: " + filename, "Device", LOG_INFO);
@@ -237,239 +186,151 @@ void handleOtaFs(AsyncWebServerRequest *request, const String &filename, size_t
     }
 }
 
-void setupSettingsRoutes(AsyncWebServer &server) {
-    server.on("/api/settings/device", HTTP_GET, [](AsyncWebServerRequest *request) {
-        if (!isAuthorized(request)) return;
-
-        AsyncResponseStream *response = request->beginResponseStream("application/json");
-        JsonDocument doc;
-        doc["name"] = appConfig.name;
-        doc["lang"] = appConfig.lang;
-        doc["tempUnit"] = appConfig.tempUnit;
-        doc["sensorUpdateInterval"] = appConfig.sensorUpdateInterval;
-        doc["thresholdTemp"] = appConfig.tempThreshold;
-        doc["thresholdHumidity"] = appConfig.humThreshold;
-        doc["thresholdPressure"] = appConfig.presThreshold;
-        doc["thresholdLight"] = appConfig.luxThreshold;
-        doc["externalSensorSet"] = appConfig.externalSensorSet;
-        doc["externalSensor"] = appConfig.externalSensor;
-        doc["combineSensors"] = appConfig.combineSensors;
-        doc["buzzerSet"] = appConfig.buzzerSet;
-        doc["buzzerTune"] = appConfig.buzzerTune;
-        doc["buzzerOpening"] = appConfig.buzzerOpening;
-        doc["buzzerClosing"] = appConfig.buzzerClosing;
-        doc["logLevel"] = appConfig.logLevel;
-        doc["logAccess"] = appConfig.logAccess;
-
-        serializeJson(doc, *response);
-        request->send(response);
-    });
-
-    server.on("/api/settings/device", HTTP_POST, [](AsyncWebServerRequest *request) {
-        if (!isAuthorized(request)) return;
-
-        pref.begin("deviceSettings");
-
-        if (request->hasParam("name", true)) {
-            const String name = request->getParam("name", true)->value();
-            pref.putString("name", name);
-        }
-
-        if (request->hasParam("lang", true)) {
-            const String lang = request->getParam("lang", true)->value();
-            pref.putString("lang", lang);
-        }
-
-        if (request->hasParam("tempUnit", true)) {
-            const int tempUnit = request->getParam("tempUnit", true)->value().toInt();
-            pref.putInt("tempUnit", tempUnit);
-        }
-
-        if (request->hasParam("sensorUpdateInterval", true)) {
-            const int sensorUpdateInterval = request->getParam("sensorUpdateInterval", true)->value().toInt();
-            pref.putInt("sensorInterval", sensorUpdateInterval);
-        }
-
-        if (request->hasParam("thresholdTemp", true)) {
-            const float thresholdTemp = request->getParam("thresholdTemp", true)->value().toFloat();
-            pref.putFloat("thresholdTemp", thresholdTemp);
-        }
-
-        if (request->hasParam("thresholdHumidity", true)) {
-            const int thresholdHum = request->getParam("thresholdHumidity", true)->value().toInt();
-            pref.putInt("thresholdHum", thresholdHum);
-        }
-
-        if (request->hasParam("thresholdPressure", true)) {
-            const int thresholdPres = request->getParam("thresholdPressure", true)->value().toInt();
-            pref.putInt("thresholdPres", thresholdPres);
-        }
-
-        if (request->hasParam("thresholdLight", true)) {
-            const int thresholdLight = request->getParam("thresholdLight", true)->value().toInt();
-            pref.putInt("thresholdLux", thresholdLight);
-        }
-
-        if (request->hasParam("externalSensorSet", true)) {
-            const String val = request->getParam("externalSensorSet", true)->value();
-
-            bool externalSensorSet = false;
-            if (val == "true" || val == "1") {
-                externalSensorSet = true;
-            }
-
-            pref.putBool("extSensorSet", externalSensorSet);
-        }
-
-        if (request->hasParam("externalSensor", true)) {
-            const int externalSensor = request->getParam("externalSensor", true)->value().toInt();
-            pref.putInt("extSensor", externalSensor);
-        }
-
-        if (request->hasParam("combineSensors", true)) {
-            const String val = request->getParam("combineSensors", true)->value();
-
-            bool combineSensors = false;
-            if (val == "true" || val == "1") {
-                combineSensors = true;
-            }
-
-            pref.putBool("combineSensors", combineSensors);
-        }
-
-        if (request->hasParam("buzzerSet", true)) {
-            const String val = request->getParam("buzzerSet", true)->value();
-
-            bool buzzerSet = false;
-            if (val == "true" || val == "1") {
-                buzzerSet = true;
-            }
-
-            pref.putBool("buzzerSet", buzzerSet);
-        }
-
-        if (request->hasParam("buzzerTune", true)) {
-            const int buzzerTune = request->getParam("buzzerTune", true)->value().toInt();
-            pref.putInt("buzzerTune", buzzerTune);
-        }
-
-        if (request->hasParam("buzzerOpening", true)) {
-            const String val = request->getParam("buzzerOpening", true)->value();
-
-            bool buzzerOpening = false;
-            if (val == "true" || val == "1") {
-                buzzerOpening = true;
-            }
-
-            pref.putBool("buzzerOpening", buzzerOpening);
-        }
-
-        if (request->hasParam("buzzerClosing", true)) {
-            const String val = request->getParam("buzzerClosing", true)->value();
-
-            bool buzzerClosing = false;
-            if (val == "true" || val == "1") {
-                buzzerClosing = true;
-            }
-
-            pref.putBool("buzzerClosing", buzzerClosing);
-        }
+// settings are applied right away, only some of them need a restart
+void sendSettingsResult(AsyncWebServerRequest *request, SETTINGS_RESULT result, uint8_t effects) {
+    if (result == SETTINGS_INVALID) {
+        request->send(400, "application/json", "{\"status\":\"invalid\"}");
+        return;
+    }
+    if (result == SETTINGS_UNSUPPORTED) {
+        request->send(400, "application/json", "{\"status\":\"unsupported\",\"error\":\"TLS is not supported by this firmware build\"}");
+        return;
+    }
+    if (result == SETTINGS_FAILED) {
+        request->send(500, "application/json", "{\"status\":\"failed\"}");
+        return;
+    }
 
-        if (request->hasParam("logLevel", true)) {
-            const uint8_t val = request->getParam("logLevel", true)->value().toInt();
+    // a partial save is committed as well, the written fields are already in use
+    const bool restart = settingsCommit(effects);
+    if (result == SETTINGS_PARTIAL) {
+        request->send(500, "application/json", restart ? "{\"status\":\"partial\",\"restart\":true}" : "{\"status\":\"partial\",\"restart\":false}");
+    } else {
+        request->send(200, "application/json", restart ? "{\"status\":\"saved\",\"restart\":true}" : "{\"status\":\"saved\",\"restart\":false}");
+    }
 
-            pref.putInt("logLevel", val);
-        }
+    if (restart) {
+        request->onDisconnect([]() {
+            delay(100);
+            ESP.restart();
+        });
+    }
+}
 
-        if (request->hasParam("logAccess", true)) {
-            const String val = request->getParam("logAccess", true)->value();
+// settings json with a versioned etag, the same for all settings endpoints
+void sendSettings(AsyncWebServerRequest *request, void (*build)(JsonDocument &doc)) {
+    char etag[ETAG_LEN];
+    versionEtag(etag, sizeof(etag), 'c', settingsVersion);
+    if (sendNotModified(request, etag)) return;
 
-            bool logAccess = false;
-            if (val == "true" || val == "1") {
-                logAccess = true;
-            }
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    JsonDocument doc;
+    build(doc);
 
-            pref.putBool("logAccess", logAccess);
-            Serial.println("Access logging: " + String(logAccess));
+    serializeJson(doc, *response);
+    request->send(response);
+}
 
-            // if loggging is set to false delete the existing file
-            if (!logAccess) {
-                deleteLogFile("/log-access.txt");
-            }
+// form fields are passed as strings, the schema converts and checks them
+void applySettingsForm(AsyncWebServerRequest *request, const SettingsSchema &schema) {
+    JsonDocument doc;
+    JsonObject obj = doc.to<JsonObject>();
+    for (size_t i = 0; i < request->params(); i++) {
+        const AsyncWebParameter* p = request->getParam(i);
+        if (p->isPost()) {
+            obj[p->name()] = p->value();
         }
+    }
 
-        pref.end();
+    uint8_t effects = SETTINGS_LIVE;
+    const SETTINGS_RESULT result = settingsApply(schema, obj, effects);
+    sendSettingsResult(request, result, effects);
+}
 
-        request->send(200, "application/json", "{\"status\":\"saved\"}");
-        request->onDisconnect([]() {
-            delay(100);
-            ESP.restart();
+void setupSettingsRoutes(AsyncWebServer &server) {
+    server.on("/api/settings/device", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+        sendSettings(request, [](JsonDocument &doc) {
+            settingsToJson(settingsDevice, doc.to<JsonObject>());
         });
     });
 
-    server.on("/api/settings/ha", HTTP_GET, [](AsyncWebServerRequest *request) {
+    server.on("/api/settings/device", HTTP_POST, [](AsyncWebServerRequest *request) {
         if (!isAuthorized(request)) return;
+        applySettingsForm(request, settingsDevice);
+    });
 
-        AsyncResponseStream *response = request->beginResponseStream("application/json");
-        JsonDocument doc;
-        doc["activate"] = appConfig.haSet;
-        doc["ip"] = appConfig.haIp;
-        doc["port"] = appConfig.haPort;
-        doc["user"] = appConfig.haUser;
-        doc["pwd"] = appConfig.haPwd;
-
-        serializeJson(doc, *response);
-        request->send(response);
+    server.on("/api/settings/ha", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+        sendSettings(request, [](JsonDocument &doc) {
+            settingsToJson(settingsHa, doc.to<JsonObject>());
+        });
     });
 
     server.on("/api/settings/ha", HTTP_POST, [](AsyncWebServerRequest *request) {
         if (!isAuthorized(request)) return;
+        applySettingsForm(request, settingsHa);
+    });
 
-        pref.begin("haSettings");
+    // device and HA settings in one json document, e.g. {"device":{...},"ha":{...}}
+    server.on("/api/settings/bulk", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+        sendSettings(request, [](JsonDocument &doc) {
+            settingsToJson(settingsDevice, doc["device"].to<JsonObject>());
+            settingsToJson(settingsHa, doc["ha"].to<JsonObject>());
+        });
+    });
 
-        if (request->hasParam("activate", true)) {
-            const String val = request->getParam("activate", true)->value();
+    server.on("/api/settings/bulk", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
 
-            bool activate = false;
-            if (val == "true" || val == "1") {
-                activate = true;
-            }
-            pref.putBool("activate", activate);
+        uint8_t effects = SETTINGS_LIVE;
+        const char* body = (const char*)request->_tempObject;
+        if (body == nullptr) {
+            request->send(400, "application/json", "{\"status\":\"invalid\"}");
+            return;
         }
 
-        if (request->hasParam("ip", true)) {
-            const String haIp = request->getParam("ip", true)->value();
-            pref.putString("ip", haIp);
-        }
+        const SETTINGS_RESULT result = settingsApplyJson(body, request->contentLength(), effects);
+        sendSettingsResult(request, result, effects);
 
-        if (request->hasParam("port", true)) {
-            const int port = request->getParam("port", true)->value().toInt();
-            pref.putInt("port", port);
+    }, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // collected in the request, the server frees it with the request
+        if (total > SETTINGS_JSON_MAX) {
+            return;
         }
-
-        if (request->hasParam("user", true)) {
-            const String user = request->getParam("user", true)->value();
-            pref.putString("user", user);
+        if (index == 0) {
+            request->_tempObject = malloc(total);
         }
-
-        if (request->hasParam("pwd", true)) {
-            const String pwd = request->getParam("pwd", true)->value();
-            pref.putString("pwd", pwd);
+        if (request->_tempObject != nullptr) {
+            memcpy((uint8_t*)request->_tempObject + index, data, len);
         }
+    });
 
-        pref.end();
-
-        request->send(200, "application/json", "{\"status\":\"saved\"}");
-        request->onDisconnect([]() {
-            delay(100);
-            ESP.restart();
+    server.on("/api/settings/syslog", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+        sendSettings(request, [](JsonDocument &doc) {
+            settingsToJson(settingsSyslog, doc.to<JsonObject>());
         });
     });
 
+    server.on("/api/settings/syslog", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+        applySettingsForm(request, settingsSyslog);
+    });
+
     server.on("/api/settings/security", HTTP_GET, [](AsyncWebServerRequest *request) {
         if (!isAuthorized(request)) return;
 
+        char etag[ETAG_LEN];
+        versionEtag(etag, sizeof(etag), 'c', settingsVersion);
+        if (sendNotModified(request, etag)) return;
+
         AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->addHeader("ETag", etag);
+        response->addHeader("Cache-Control", "no-cache");
         JsonDocument doc;
         doc["useAuth"] = appConfig.useAuth;
 
@@ -489,6 +350,7 @@ void setupSettingsRoutes(AsyncWebServer &server) {
             if (pwd.length() > 0) {
                 String output = sha256(pwd);
                 pref.putString("adminPwd", output);
+                authRevokeAll();
 
                 logger("Admin password updated", "Device", LOG_WARNING);
             }
@@ -558,6 +420,11 @@ void setupFileRoutes(AsyncWebServer &server) {
     server.on("/api/ota/fw", HTTP_POST, [](AsyncWebServerRequest *request) { 
         if (!isAuthorized(request)) return;
 
+        if (otaRateLimited) {
+            sendRateLimited(request);
+            return;
+        }
+
         if(Update.hasError()) {
             request->send(500, "text/plain", "OTA Firmware update failed! Check Logs for details.");
 
@@ -579,6 +446,11 @@ void setupFileRoutes(AsyncWebServer &server) {
     server.on("/api/ota/fs", HTTP_POST, [](AsyncWebServerRequest *request) { 
         if (!isAuthorized(request)) return;
 
+        if (otaRateLimited) {
+            sendRateLimited(request);
+            return;
+        }
+
         if(Update.hasError()) {
             request->send(500, "text/plain", "OTA Filesystem update failed! Check Logs for details.");
 
@@ -600,24 +472,108 @@ void setupFileRoutes(AsyncWebServer &server) {
 
 void setupApiRoutes(AsyncWebServer &server) {
 
-    // simple token check endpoint
+    // end the session of the token in the Authorization header
+    server.on("/api/auth/logout", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (request->hasHeader("Authorization")) {
+            AuthSession *session = authVerify(request->getHeader("Authorization")->value());
+            if (session != nullptr) {
+                authRevoke(session);
+            }
+        }
+        request->send(200, "application/json", "{\"status\":\"ok\"}");
+    });
+
+    // end all sessions, including the one of the caller
+    server.on("/api/auth/revoke", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+
+        authRevokeAll();
+        logger("All sessions revoked", "Device", LOG_WARNING);
+        request->send(200, "application/json", "{\"status\":\"ok\"}");
+    });
+
+    // per request cost of the session check compared to signing and password hashing
+    server.on("/api/auth/bench", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!isAuthorized(request)) return;
+
+        // full table of its own, the issued sessions and counters are not touched
+        AuthSession table[AUTH_SESSIONS];
+        for (AuthSession &entry : table) {
+            entry.id = esp_random() | 1;
+            entry.expiry = authUptime() + AUTH_TTL;
+            authSign(entry.id, entry.expiry, entry.tag);
+        }
+
+        // the last entry is the slowest to find
+        const AuthSession &session = table[AUTH_SESSIONS - 1];
+        char token[AUTH_TOKEN_LEN];
+        snprintf(token, sizeof(token), "%08x.%x.%s", (unsigned)session.id, (unsigned)session.expiry, session.tag);
+        const String tokenStr(token);
+
+        const uint16_t iterations = 200;
+        char tag[AUTH_TAG_HEX + 1];
+
+        unsigned long start = micros();
+        for (uint16_t i = 0; i < iterations; i++) {
+            authMatch(table, tokenStr);
+        }
+        const unsigned long verifyUs = micros() - start;
+
+        start = micros();
+        for (uint16_t i = 0; i < iterations; i++) {
+            authSign(session.id, session.expiry, tag);
+        }
+        const unsigned long hmacUs = micros() - start;
+
+        start = micros();
+        for (uint16_t i = 0; i < iterations; i++) {
+            verifyPasswordHash(sha256(tokenStr));
+        }
+        const unsigned long passwordUs = micros() - start;
+
+        JsonDocument doc;
+        doc["iterations"] = iterations;
+        doc["verifyUs"] = (float)verifyUs / iterations;
+        doc["hmacUs"] = (float)hmacUs / iterations;
+        doc["passwordUs"] = (float)passwordUs / iterations;
+
+        String response;
+        serializeJson(doc, response);
+        request->send(200, "application/json", response);
+    });
+
+    // login with the password or refresh a session, returns a session token
     server.on("/api/auth", HTTP_POST, [](AsyncWebServerRequest *request) {
+        String token;
 
         if (request->hasParam("pwd", true)) {
             const String pwd = request->getParam("pwd", true)->value();
-            String output = sha256(pwd);
 
-            if (!verifyPasswordHash(output)) {
+            if (!verifyPasswordHash(sha256(pwd))) {
                 request->send(401, "application/json", "{\"error\":\"invalid auth\"}");
-            } else {
-                request->send(200, "application/json", "{\"token\":\"" + output + "\"}");
+                return;
             }
+            token = authIssue();
+
+        } else if (!appConfig.useAuth) {
+            token = authIssue();
+
         } else {
-            if (!isAuthorized(request)) return;
+            if (!request->hasHeader("Authorization")) {
+                request->send(403, "application/json", "{\"error\":\"missing auth\"}");
+                return;
+            }
 
-            String stored = appConfig.adminPwd;
-            request->send(200, "application/json", "{\"token\":\"" + stored + "\"}");
+            const String current = request->getHeader("Authorization")->value();
+            AuthSession *session = authVerify(current);
+            if (session == nullptr) {
+                request->send(403, "application/json", "{\"error\":\"invalid auth\"}");
+                return;
+            }
+            token = authRefresh(current, session);
         }
+
+        request->send(200, "application/json", "{\"token\":\"" + token + "\"}");
     });
     
     // info endpoint returns information about the board
@@ -702,6 +658,51 @@ void setupApiRoutes(AsyncWebServer &server) {
         settings["haSet"] = appConfig.haSet;
         settings["haIp"] = appConfig.haIp;
         settings["haPort"] = appConfig.haPort;
+        settings["haDeviceDiscovery"] = appConfig.haDeviceDiscovery;
+        settings["haAggregate"] = appConfig.haAggregate;
+        settings["haKeepAlive"] = appConfig.haKeepAlive;
+        settings["haTls"] = appConfig.haTls;
+
+        JsonDocument mqtt;
+        mqtt["connected"] = mqttClientHa.connected();
+        mqtt["state"] = (int)mqttConnState;
+        mqtt["connectAttempts"] = mqttConnectAttempts;
+        mqtt["reconnects"] = mqttReconnects;
+        mqtt["lastDisconnectReason"] = mqttLastDisconnectReason;
+        JsonArray reasons = mqtt["disconnectReasons"].to<JsonArray>();
+        for (uint8_t i = 0; i < MQTT_DISCONNECT_REASONS; i++) {
+            reasons.add(mqttDisconnectReasons[i]);
+        }
+        mqtt["tls"] = appConfig.haTls;
+        mqtt["tlsSupported"] = MQTT_TLS_SUPPORTED;
+        mqtt["connectLastMs"] = mqttConnectLastMs;
+        mqtt["connectMaxMs"] = mqttConnectMaxMs;
+        mqtt["connectHeapBefore"] = mqttConnectHeapBefore;
+        mqtt["connectHeapAfter"] = mqttConnectHeapAfter;
+        mqtt["minFreeHeap"] = ESP.getMinFreeHeap();
+        mqtt["rttLastMs"] = mqttRttLastMs;
+        mqtt["rttAvgMs"] = mqttRttAvgMs;
+        mqtt["rttMaxMs"] = mqttRttMaxMs;
+        mqtt["resyncs"] = mqttResyncs;
+        mqtt["inflight"] = mqttStoreInflight();
+        mqtt["acked"] = mqttAcked;
+        mqtt["retries"] = mqttRetries;
+        mqtt["storeUsed"] = mqttStoreCount;
+        mqtt["storeSize"] = MQTT_STORE_SIZE;
+        mqtt["latencyLastUs"] = mqttLatencyLastUs;
+        mqtt["latencyAvgUs"] = mqttLatencyAvgUs;
+        mqtt["latencyMaxUs"] = mqttLatencyMaxUs;
+        mqtt["latencySamples"] = mqttLatencySamples;
+
+        JsonDocument syslog;
+        syslog["set"] = appConfig.syslogSet;
+        syslog["host"] = appConfig.syslogHost;
+        syslog["port"] = appConfig.syslogPort;
+        syslog["proto"] = appConfig.syslogProto;
+        syslog["local"] = appConfig.syslogLocal;
+        syslog["sent"] = syslogSent;
+        syslog["dropped"] = syslogDropped;
+        syslog["queued"] = syslogQueue != NULL ? uxQueueMessagesWaiting(syslogQueue) : 0;
         
         JsonDocument doc;
         doc["status"] = "ok";
@@ -709,7 +710,26 @@ void setupApiRoutes(AsyncWebServer &server) {
         doc["door"] = door;
         doc["sensor"] = sensor;
         doc["settings"] = settings;
-
+        doc["syslog"] = syslog;
+        doc["mqtt"] = mqtt;
+
+        JsonDocument http;
+        http["staticEtags"] = staticEtagCount;
+        http["notModified"] = etagNotModified;
+        http["infoRenderLastUs"] = tplRenderLastUs;
+        http["infoRenderMaxUs"] = tplRenderMaxUs;
+        http["statusCacheBuilds"] = statusCacheBuilds;
+        http["statusCacheHits"] = statusCacheHits;
+        http["wsClients"] = ws.count();
+        http["wsFramesSent"] = wsFramesSent;
+        http["wsCommands"] = wsCommands;
+        http["sensorEvents"] = sensorEvents;
+        http["rateLimited"] = rateLimited;
+        http["rateLimitedGlobal"] = rateLimitedGlobal;
+        http["authSessions"] = authSessionCount();
+        http["authIssued"] = authIssued;
+        http["authRejected"] = authRejected;
+        doc["http"] = http;
 
         serializeJson(doc, *response);
         request->send(response);
@@ -717,43 +737,25 @@ void setupApiRoutes(AsyncWebServer &server) {
 
     // status returns status of garage door and sensors
     server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-        const int doorCurrentPosition = (int)(hoermannEngine->state->currentPosition * 100);
-        const int doorTargetPosition = (int)(hoermannEngine->state->targetPosition * 100);
-        const String doorState = hoermannEngine->state->translatedState;
-        const bool light = hoermannEngine->state->lightOn;
-        const bool doorMoving = doorCurrentPosition != doorTargetPosition;
-
-        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        char etag[ETAG_LEN];
+        versionEtag(etag, sizeof(etag), 's', stateVersion);
+        if (sendNotModified(request, etag)) return;
 
-        JsonDocument door;
-        door["position_current"] = doorCurrentPosition;
-        door["position_target"] = doorTargetPosition;
-        door["state"] = doorState;
-        door["moving"] = doorMoving;
-        door["light"] = light;
+        uint32_t version;
+        char json[STATUS_CACHE_LEN];
+        const size_t len = statusSnapshot(json, sizeof(json), version);
+        versionEtag(etag, sizeof(etag), 's', version);
 
-        JsonDocument sensor;
-        sensor["temperature"] = appConfig.temperature;
-        sensor["humidity"] = appConfig.humidity;
-        sensor["pressure"] = appConfig.pressure;
-        sensor["lux"] = appConfig.lux;
-        sensor["combineSensors"] = appConfig.combineSensors;
-
-        // if exxternal sensor is set, add it to the response
-        if (appConfig.externalSensorSet) {
-            sensor["externalSensor"] = appConfig.externalSensor;
-            sensor["extSensorData"] = appConfig.extSensorData;
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->addHeader("ETag", etag);
+        response->addHeader("Cache-Control", "no-cache");
+        if (len > 0) {
+            response->write((const uint8_t*)json, len);
         } else {
-            sensor["externalSensor"] = "none";
+            JsonDocument doc;
+            statusBuild(doc);
+            serializeJson(doc, *response);
         }
-
-        JsonDocument doc;
-        doc["status"] = "ok";
-        doc["version_fw"] = VERSION;
-        doc["door"] = door;
-        doc["sensor"] = sensor;
-
-        serializeJson(doc, *response);
         request->send(response);
     });
 
@@ -1014,10 +1016,23 @@ void routing(AsyncWebServer &server) {
     setupApiRoutes(server);
     setupFileRoutes(server);
 
-    // map requests to static files
-    server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html").setFilter(ON_STA_FILTER);
-    server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
-    server.serveStatic("/settings", LittleFS, "/settings/").setDefaultFile("index.html");
+    // control, auth and OTA are rate limited per client and in total
+    initRateLimit(server);
+
+    // conditional GET for pages, images and translations
+    initStaticEtags(server);
+    initTemplates();
+
+    // map requests to static files, assets are stored gzipped (see scripts/build_data.py)
+    // css and js carry a content hash in their name and never change
+    server.serveStatic("/assets/js/i18n/", LittleFS, "/assets/js/i18n/").setCacheControl("no-cache");
+    server.serveStatic("/assets/img/", LittleFS, "/assets/img/").setCacheControl("max-age=86400");
+    server.serveStatic("/assets/", LittleFS, "/assets/").setCacheControl("public, max-age=31536000, immutable");
+
+    // pages reference the current asset names, so they are always revalidated
+    server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html").setCacheControl("no-cache").setFilter(ON_STA_FILTER);
+    server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html").setCacheControl("no-cache");
+    server.serveStatic("/settings", LittleFS, "/settings/").setDefaultFile("index.html").setCacheControl("no-cache");
 
     // captive portal mapping
     server.on("/captive", HTTP_GET, [](AsyncWebServerRequest *req) {
@@ -1043,10 +1058,11 @@ void routing(AsyncWebServer &server) {
             path += ".html";
         }
 
-        if (LittleFS.exists(path)) {
+        // pages are stored gzipped, the response picks up <path>.gz by itself
+        if (LittleFS.exists(path) || LittleFS.exists(path + ".gz")) {
             // check for info and log for processing content
-            if (path == "/info.html") {
-                request->send(LittleFS, path, String(), false, processorInfo);
+            if (path == "/info.html" && infoTemplate.text != nullptr) {
+                renderInfoTemplate(request);
                 return;
             }
 
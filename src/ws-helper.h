@@ -0,0 +1,262 @@
+/*
+* WebSocket with a compact binary protocol: snapshot on connect, deltas on change, commands
+*
+* All values little endian. Frames sent by the device:
+*   WS_SNAPSHOT / WS_DELTA  [type][field id][value]...  every field on connect, changed fields after
+*   WS_ACK                  [type][action][WS_STATUS]
+* Frames sent by the client:
+*   WS_COMMAND              [type][WS_ACTION][argument]  argument = position 0-100 or light 0/1
+*
+* Field values: door fields 1 byte, sensor fields float32.
+* Authentication with ?token=<session token> on connect, same token as the Authorization header.
+*/
+#include <ESPAsyncWebServer.h>
+
+#define WS_MAX_CLIENTS 4
+#define WS_FRAME_LEN 64
+
+extern AsyncWebSocket ws;
+
+enum WS_FRAME : uint8_t {
+    WS_SNAPSHOT = 0x01,
+    WS_DELTA = 0x02,
+    WS_ACK = 0x03,
+    WS_COMMAND = 0x10
+};
+
+enum WS_FIELD : uint8_t {
+    WS_POSITION_CURRENT = 1,    // uint8 0-100
+    WS_POSITION_TARGET = 2,     // uint8 0-100
+    WS_DOOR_STATE = 3,          // uint8 HoermannState::State
+    WS_LIGHT = 4,               // uint8 0/1
+    WS_MOVING = 5,              // uint8 0/1
+    WS_TEMPERATURE = 10,        // float32
+    WS_HUMIDITY = 11,           // float32
+    WS_PRESSURE = 12,           // float32
+    WS_LUX = 13                 // float32
+};
+
+enum WS_ACTION : uint8_t {
+    WS_OPEN = 1,
+    WS_CLOSE = 2,
+    WS_STOP = 3,
+    WS_VENT = 4,
+    WS_HALF = 5,
+    WS_TOGGLE = 6,
+    WS_LIGHT_SET = 7,
+    WS_POSITION = 8
+};
+
+enum WS_STATUS : uint8_t {
+    WS_OK = 0,
+    WS_INVALID = 1,
+    WS_LIMITED = 2
+};
+
+/**
+ * Values as last broadcast, deltas are computed against it
+ */
+struct WsState {
+    uint8_t positionCurrent;
+    uint8_t positionTarget;
+    uint8_t doorState;
+    uint8_t light;
+    uint8_t moving;
+    float temperature;
+    float humidity;
+    float pressure;
+    float lux;
+};
+
+WsState wsLast;
+uint32_t wsVersion = 0;
+uint32_t wsFramesSent = 0;
+uint32_t wsCommands = 0;
+
+
+void wsReadState(WsState &s) {
+    const HoermannState &door = *hoermannEngine->state;
+    s.positionCurrent = (uint8_t)(door.currentPosition * 100);
+    s.positionTarget = (uint8_t)(door.targetPosition * 100);
+    s.doorState = (uint8_t)door.state;
+    s.light = door.lightOn;
+    s.moving = s.positionCurrent != s.positionTarget;
+    s.temperature = appConfig.temperature;
+    s.humidity = appConfig.humidity;
+    s.pressure = appConfig.pressure;
+    s.lux = appConfig.lux;
+}
+
+
+/**
+ * Encode all fields (prev == nullptr) or the fields that differ from prev
+ * @return frame length, 1 if nothing changed
+ */
+size_t wsEncode(uint8_t type, const WsState &s, const WsState *prev, uint8_t *out) {
+    size_t len = 0;
+    out[len++] = type;
+
+    auto putByte = [&](uint8_t id, uint8_t value, uint8_t old) {
+        if (prev == nullptr || value != old) {
+            out[len++] = id;
+            out[len++] = value;
+        }
+    };
+    auto putFloat = [&](uint8_t id, float value, float old) {
+        if (prev == nullptr || value != old) {
+            out[len++] = id;
+            memcpy(out + len, &value, sizeof(value));
+            len += sizeof(value);
+        }
+    };
+
+    putByte(WS_POSITION_CURRENT, s.positionCurrent, prev ? prev->positionCurrent : 0);
+    putByte(WS_POSITION_TARGET, s.positionTarget, prev ? prev->positionTarget : 0);
+    putByte(WS_DOOR_STATE, s.doorState, prev ? prev->doorState : 0);
+    putByte(WS_LIGHT, s.light, prev ? prev->light : 0);
+    putByte(WS_MOVING, s.moving, prev ? prev->moving : 0);
+    putFloat(WS_TEMPERATURE, s.temperature, prev ? prev->temperature : 0);
+    putFloat(WS_HUMIDITY, s.humidity, prev ? prev->humidity : 0);
+    putFloat(WS_PRESSURE, s.pressure, prev ? prev->pressure : 0);
+    putFloat(WS_LUX, s.lux, prev ? prev->lux : 0);
+
+    return len;
+}
+
+
+// send the changed fields to all clients, called from the loop
+void wsLoop() {
+    // also while the state is unchanged, enforces the client cap and drops dead clients
+    ws.cleanupClients(WS_MAX_CLIENTS);
+
+    if (wsVersion == stateVersion) {
+        return;
+    }
+    wsVersion = stateVersion;
+
+    WsState current;
+    wsReadState(current);
+
+    uint8_t frame[WS_FRAME_LEN];
+    const size_t len = wsEncode(WS_DELTA, current, &wsLast, frame);
+    wsLast = current;
+
+    if (len > 1 && ws.count() > 0) {
+        ws.binaryAll(frame, len);
+        wsFramesSent++;
+    }
+}
+
+
+void wsSendAck(AsyncWebSocketClient *client, uint8_t action, uint8_t status) {
+    const uint8_t frame[] = {WS_ACK, action, status};
+    client->binary(frame, sizeof(frame));
+}
+
+
+// same actions as /api/control, logged with source "ws"
+void wsHandleCommand(AsyncWebSocketClient *client, const uint8_t *data, size_t len) {
+    if (len < 2 || data[0] != WS_COMMAND) {
+        return;
+    }
+
+    const uint8_t action = data[1];
+    const uint8_t arg = len > 2 ? data[2] : 0;
+    wsCommands++;
+
+    if (!rateLimitAllow(client->remoteIP(), RATE_COST_CONTROL)) {
+        wsSendAck(client, action, WS_LIMITED);
+        return;
+    }
+
+    switch (action) {
+        case WS_OPEN:
+            hoermannEngine->openDoor();
+            loggerAccess("Door opened", "ws");
+            break;
+
+        case WS_CLOSE:
+            hoermannEngine->closeDoor();
+            loggerAccess("Door closed", "ws");
+            break;
+
+        case WS_STOP:
+            hoermannEngine->stopDoor();
+            loggerAccess("Door movement stopped", "ws");
+            break;
+
+        case WS_VENT:
+            hoermannEngine->ventilationPositionDoor();
+            loggerAccess("Door vent opened", "ws");
+            break;
+
+        case WS_HALF:
+            hoermannEngine->halfPositionDoor();
+            loggerAccess("Door half opened", "ws");
+            break;
+
+        case WS_TOGGLE:
+            hoermannEngine->toggleDoor();
+            loggerAccess("Door toggled", "ws");
+            break;
+
+        case WS_LIGHT_SET:
+            if (len < 3 || arg > 1) {
+                wsSendAck(client, action, WS_INVALID);
+                return;
+            }
+            hoermannEngine->turnLight(arg != 0);
+            loggerAccess(arg != 0 ? "Light turned on" : "Light turned off", "ws");
+            break;
+
+        case WS_POSITION:
+            if (len < 3 || arg > 100) {
+                wsSendAck(client, action, WS_INVALID);
+                return;
+            }
+            hoermannEngine->setPosition(arg);
+            loggerAccess("Door moved to position " + String(arg) + "%", "ws");
+            break;
+
+        default:
+            wsSendAck(client, action, WS_INVALID);
+            return;
+    }
+
+    wsSendAck(client, action, WS_OK);
+}
+
+
+void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    if (type == WS_EVT_CONNECT) {
+        WsState current;
+        wsReadState(current);
+
+        uint8_t frame[WS_FRAME_LEN];
+        const size_t frameLen = wsEncode(WS_SNAPSHOT, current, nullptr, frame);
+        client->binary(frame, frameLen);
+        wsFramesSent++;
+
+    } else if (type == WS_EVT_DATA) {
+        // commands are small, only complete single frame messages are accepted
+        const AwsFrameInfo *info = (AwsFrameInfo *)arg;
+        if (info->final && info->index == 0 && info->len == len && info->opcode == WS_BINARY) {
+            wsHandleCommand(client, data, len);
+        }
+    }
+}
+
+
+void initWebSocket(AsyncWebServer &server) {
+    // browsers can not set headers on a websocket, the token comes as query parameter
+    ws.handleHandshake([](AsyncWebServerRequest *request) {
+        if (!appConfig.useAuth) {
+            return true;
+        }
+        return request->hasParam("token") && authVerify(request->getParam("token")->value()) != nullptr;
+    });
+
+    ws.onEvent(onWsEvent);
+    server.addHandler(&ws);
+    wsReadState(wsLast);
+}